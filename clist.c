@@ -10,362 +10,2765 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "clist.h"
 
+#ifndef NDEBUG
 #define DEBUG
+#endif
 
 struct _cl_node {
   CListElementType element;
   struct _cl_node *next;
 };
 
+// Flags for struct _clist
+#define CL_FLAG_CALLER_STORAGE  0x1   // header lives in a CListStorage
+#define CL_FLAG_READ_MOSTLY     0x2   // lock-free readers; see CL_read_lock
+#define CL_FLAG_QUEUE           0x4   // priority queue; see _CL_settle
+
+// Stores that a concurrent reader of a read-mostly list may observe
+// are published with release semantics, and readers load with acquire
+// semantics, so a reader that sees a node also sees its contents.
+#define _CL_PUBLISH(lvalue, value)  __atomic_store_n(&(lvalue), (value), __ATOMIC_RELEASE)
+#define _CL_READ(lvalue)            __atomic_load_n(&(lvalue), __ATOMIC_ACQUIRE)
+
+// Memory that a list's elements point into, released by CL_free
+struct _cl_storage {
+  void *addr;                   // an mmap'd region
+  size_t len;
+  struct _cl_storage *next;
+};
+
 struct _clist {
   struct _cl_node *head;
-  int length;
+  int64_t length;
+  unsigned int flags;
+
+  // The last position found by CL_insert or CL_remove, so that a walk
+  // to the same or a later position can start from there. finger_node
+  // is NULL when there is no finger. Only writers move it; CL_nth reads
+  // it, except on read-mostly lists, whose readers may run alongside
+  // the writer and so always walk from the head.
+  struct _cl_node *finger_node;
+  int64_t finger_pos;
+
+  // Changed whenever nodes are added, freed or relinked, so that a
+  // thread's CL_nth cursor (see _CL_cursor) can tell it is stale
+  uint64_t version;
+
+  // Where the header (unless CL_FLAG_CALLER_STORAGE) and the
+  // non-inline nodes come from
+  const CListAllocator *allocator;
+
+  // Regions holding the elements, for lists built by CL_from_file
+  struct _cl_storage *storage;
+
+  // Elements added to a priority-queue list by CL_insert_sorted, in a
+  // CL_HEAP_ARITY-ary min-heap. The list is the chain merged with the
+  // heap; length counts only the chain.
+  CListElementType *heap;
+  int64_t heap_len, heap_cap;
+
+  // The first few nodes of a list are carved out of this inline
+  // buffer instead of being malloc'd. Bit i of inline_used is set when
+  // inline_nodes[i] is linked into some chain.
+  unsigned int inline_used;
+  struct _cl_node inline_nodes[CL_INLINE_NODES];
+
+#ifdef CL_STATS
+  CListStats stats;
+#endif
+};
+
+_Static_assert(sizeof(struct _clist) <= sizeof(CListStorage),
+               "CL_STORAGE_SIZE is too small for struct _clist");
+_Static_assert(CL_INLINE_NODES <= 8 * sizeof(unsigned int),
+               "inline_used cannot track that many inline nodes");
+
+#define CL_INLINE_FULL  ((unsigned int) ((1ULL << CL_INLINE_NODES) - 1))
+
+// Each list's versions start at a fresh multiple of 2^32, so that a
+// cursor left on a freed list cannot match a new list at the same
+// address
+static uint64_t _CL_next_version;
+
+// The last position found by this thread's CL_nth. Unlike the list's
+// finger it is private to the thread, so CL_nth stays a pure read of
+// the list and may run alongside other readers. It is valid only
+// while list->version still equals version.
+static __thread struct {
+  CList list;
+  uint64_t version;
+  struct _cl_node *node;
+  int64_t pos;
+} _CL_cursor;
+
+// Children per node of a priority-queue list's heap. Four keeps the
+// heap shallow, and a node's children share a cache line.
+#define CL_HEAP_ARITY  4
+
+
+
+/*
+ * The default allocator: plain malloc and free
+ */
+static void *_CL_malloc(size_t size, void *ctx)
+{
+  (void) ctx;
+  return malloc(size);
+}
+
+static void _CL_free(void *ptr, size_t size, void *ctx)
+{
+  (void) size;
+  (void) ctx;
+  free(ptr);
+}
+
+const CListAllocator CL_malloc_allocator = { _CL_malloc, _CL_free, NULL };
+
+
+/*
+ * The thread-caching allocator keeps freed small blocks on a per-thread
+ * free list, so that list churn on one thread never touches malloc's
+ * shared state. All small requests are rounded up to one block size,
+ * which makes any cached block reusable for any small request and lets
+ * a block freed on one thread be reused on another.
+ */
+#define CL_CACHE_BLOCK_SIZE  32
+#define CL_CACHE_MAX_BLOCKS  4096
+
+struct _cl_cache_block {
+  struct _cl_cache_block *next;
+};
+
+static __thread struct _cl_cache_block *_CL_cache_head;
+static __thread int _CL_cache_count;
+
+static pthread_key_t _CL_cache_key;
+static pthread_once_t _CL_cache_once = PTHREAD_ONCE_INIT;
+
+static void _CL_cache_thread_exit(void *unused)
+{
+  (void) unused;
+  CL_thread_cache_flush();
+}
+
+static void _CL_cache_make_key(void)
+{
+  pthread_key_create(&_CL_cache_key, _CL_cache_thread_exit);
+}
+
+static void *_CL_cache_alloc(size_t size, void *ctx)
+{
+  (void) ctx;
+
+  if (size > CL_CACHE_BLOCK_SIZE)
+    return malloc(size);
+
+  struct _cl_cache_block *block = _CL_cache_head;
+  if (block == NULL)
+    return malloc(CL_CACHE_BLOCK_SIZE);
+
+  _CL_cache_head = block->next;
+  _CL_cache_count--;
+  return block;
+}
+
+static void _CL_cache_free(void *ptr, size_t size, void *ctx)
+{
+  (void) ctx;
+
+  if (size > CL_CACHE_BLOCK_SIZE || _CL_cache_count >= CL_CACHE_MAX_BLOCKS) {
+    free(ptr);
+    return;
+  }
+
+  if (_CL_cache_count == 0) {
+    // Make sure the cache is flushed when this thread exits
+    pthread_once(&_CL_cache_once, _CL_cache_make_key);
+    pthread_setspecific(_CL_cache_key, (void *) 1);
+  }
+
+  struct _cl_cache_block *block = ptr;
+  block->next = _CL_cache_head;
+  _CL_cache_head = block;
+  _CL_cache_count++;
+}
+
+const CListAllocator CL_thread_cache_allocator = { _CL_cache_alloc, _CL_cache_free, NULL };
+
+
+// Documented in .h file
+void CL_thread_cache_flush(void)
+{
+  while (_CL_cache_head != NULL) {
+    struct _cl_cache_block *block = _CL_cache_head;
+    _CL_cache_head = block->next;
+    free(block);
+  }
+  _CL_cache_count = 0;
+}
+
+
+/*
+ * Epoch-based reclamation for read-mostly lists.
+ *
+ * Each reading thread owns a _cl_reader record. While inside a
+ * read-side section, the record holds the global epoch observed on
+ * entry; outside, it holds 0. A node unlinked by a writer is retired
+ * with the current epoch, and the epoch is then advanced. Readers that
+ * entered after that cannot reach the node, so it may be freed as soon
+ * as every active reader's epoch is newer than the node's.
+ */
+struct _cl_reader {
+  uint64_t epoch;               // 0 when not in a read-side section
+  int in_use;                   // record is owned by a live thread
+  struct _cl_reader *next;      // records are never unlinked
+};
+
+// Retired blocks wait in a queue of chunks, oldest first. Epochs only
+// grow, so the queue is in epoch order, and reclaiming can stop at the
+// first block that is still too new.
+#define CL_RETIRE_CHUNK 256
+
+struct _cl_retired_chunk {
+  struct _cl_retired_chunk *next;       // the next newer chunk
+  int first, count;                     // items[first..count) are waiting
+  struct {
+    void *ptr;
+    uint64_t epoch;
+  } items[CL_RETIRE_CHUNK];
+};
+
+// Retired memory is reclaimed once this many more blocks are waiting
+// than were left by the last attempt
+#define CL_RETIRE_BATCH 64
+
+static uint64_t _CL_epoch = 1;
+static struct _cl_reader *_CL_readers;
+static struct _cl_retired_chunk *_CL_retired_head, *_CL_retired_tail;
+static long _CL_num_retired;
+static long _CL_reclaim_at = CL_RETIRE_BATCH;
+static pthread_mutex_t _CL_retired_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct _cl_reader *_CL_my_reader;
+static __thread int _CL_read_nesting;
+
+static pthread_key_t _CL_reader_key;
+static pthread_once_t _CL_reader_once = PTHREAD_ONCE_INIT;
+
+static void _CL_reader_thread_exit(void *reader)
+{
+  struct _cl_reader *r = reader;
+  __atomic_store_n(&r->epoch, 0, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void _CL_reader_make_key(void)
+{
+  pthread_key_create(&_CL_reader_key, _CL_reader_thread_exit);
+}
+
+
+/*
+ * Find or create the calling thread's reader record
+ */
+static struct _cl_reader *_CL_get_reader(void)
+{
+  if (_CL_my_reader != NULL)
+    return _CL_my_reader;
+
+  struct _cl_reader *r;
+
+  // Reuse a record left behind by an exited thread, if any
+  for (r = _CL_READ(_CL_readers); r != NULL; r = r->next) {
+    int expected = 0;
+    if (__atomic_compare_exchange_n(&r->in_use, &expected, 1, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      break;
+  }
+
+  if (r == NULL) {
+    r = malloc(sizeof(*r));
+    assert(r);
+    r->epoch = 0;
+    r->in_use = 1;
+    r->next = _CL_READ(_CL_readers);
+    while (!__atomic_compare_exchange_n(&_CL_readers, &r->next, r, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+  }
+
+  pthread_once(&_CL_reader_once, _CL_reader_make_key);
+  pthread_setspecific(_CL_reader_key, r);
+  _CL_my_reader = r;
+
+  return r;
+}
+
+
+// Documented in .h file
+void CL_read_lock(void)
+{
+  if (_CL_read_nesting++ > 0)
+    return;
+
+  struct _cl_reader *r = _CL_get_reader();
+  __atomic_store_n(&r->epoch, __atomic_load_n(&_CL_epoch, __ATOMIC_SEQ_CST),
+                   __ATOMIC_SEQ_CST);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+
+// Documented in .h file
+void CL_read_unlock(void)
+{
+  assert(_CL_read_nesting > 0);
+
+  if (--_CL_read_nesting == 0)
+    __atomic_store_n(&_CL_my_reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Free all retired blocks that no reader can still reach. If wait is
+ * true, keep trying until every retired block has been freed.
+ */
+static void _CL_reclaim(bool wait)
+{
+  pthread_mutex_lock(&_CL_retired_lock);
+
+  for (;;) {
+    __atomic_fetch_add(&_CL_epoch, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    uint64_t oldest = UINT64_MAX;
+    for (struct _cl_reader *r = _CL_READ(_CL_readers); r != NULL; r = r->next) {
+      uint64_t e = __atomic_load_n(&r->epoch, __ATOMIC_SEQ_CST);
+      if (e != 0 && e < oldest)
+        oldest = e;
+    }
+
+    // Free from the oldest end until a block some reader may still see
+    struct _cl_retired_chunk *chunk;
+    while ((chunk = _CL_retired_head) != NULL) {
+      while (chunk->first < chunk->count && chunk->items[chunk->first].epoch < oldest) {
+        free(chunk->items[chunk->first++].ptr);
+        _CL_num_retired--;
+      }
+      if (chunk->first < chunk->count)
+        break;
+
+      if (chunk == _CL_retired_tail) {
+        chunk->first = chunk->count = 0;
+        break;
+      }
+      _CL_retired_head = chunk->next;
+      free(chunk);
+    }
+
+    if (!wait || _CL_num_retired == 0)
+      break;
+    sched_yield();
+  }
+
+  // While a reader holds old blocks back, wait for another batch
+  // before trying again, rather than trying on every retirement
+  _CL_reclaim_at = _CL_num_retired + CL_RETIRE_BATCH;
+
+  pthread_mutex_unlock(&_CL_retired_lock);
+}
+
+
+/*
+ * Free a malloc'd block once no reader can still be using it
+ */
+static void _CL_retire(void *ptr)
+{
+  pthread_mutex_lock(&_CL_retired_lock);
+
+  struct _cl_retired_chunk *chunk = _CL_retired_tail;
+  if (chunk == NULL || chunk->count == CL_RETIRE_CHUNK) {
+    chunk = malloc(sizeof(struct _cl_retired_chunk));
+    assert(chunk);
+    chunk->next = NULL;
+    chunk->first = chunk->count = 0;
+    if (_CL_retired_tail != NULL)
+      _CL_retired_tail->next = chunk;
+    else
+      _CL_retired_head = chunk;
+    _CL_retired_tail = chunk;
+  }
+
+  chunk->items[chunk->count].ptr = ptr;
+  chunk->items[chunk->count].epoch = __atomic_load_n(&_CL_epoch, __ATOMIC_SEQ_CST);
+  chunk->count++;
+  bool full = (++_CL_num_retired >= _CL_reclaim_at);
+  pthread_mutex_unlock(&_CL_retired_lock);
+
+  if (full)
+    _CL_reclaim(false);
+}
+
+
+// Documented in .h file
+void CL_synchronize(void)
+{
+  assert(_CL_read_nesting == 0);
+  _CL_reclaim(true);
+}
+
+
+#ifdef CL_STATS
+// Totals over all lists. Lists may live on different threads, and
+// read-mostly lists are read by many threads at once, so all counters
+// are updated atomically.
+static CListStats _CL_global_stats;
+
+#define _CL_STAT_ADD(list, field, n) do {                               \
+    __atomic_fetch_add(&(list)->stats.field, (n), __ATOMIC_RELAXED);    \
+    __atomic_fetch_add(&_CL_global_stats.field, (n), __ATOMIC_RELAXED); \
+  } while (0)
+
+#define _CL_STAT_PEAK(list) do {                                        \
+    if ((list)->length > (list)->stats.peak_length)                     \
+      (list)->stats.peak_length = (list)->length;                       \
+    long long _peak = __atomic_load_n(&_CL_global_stats.peak_length,          \
+                                __ATOMIC_RELAXED);                      \
+    while ((list)->length > _peak                                       \
+           && !__atomic_compare_exchange_n(&_CL_global_stats.peak_length, \
+                  &_peak, (list)->length, true,                         \
+                  __ATOMIC_RELAXED, __ATOMIC_RELAXED))                  \
+      ;                                                                 \
+  } while (0)
+#else
+#define _CL_STAT_ADD(list, field, n)  ((void) 0)
+#define _CL_STAT_PEAK(list)           ((void) 0)
+#endif // CL_STATS
+
+
+
+/*
+ * Create a new _cl_node for list and populate it with the supplied
+ * values. A free slot in the list's inline buffer is used if there is
+ * one; otherwise the node comes from the list's allocator.
+ *
+ * Parameters:
+ *   list           the list which will own the node
+ *   element, next  the values for the node to be created
+ * 
+ * Returns: The new node
+ */
+static struct _cl_node*
+_CL_new_node(CList list, CListElementType element, struct _cl_node *next)
+{
+  struct _cl_node* new;
+
+  // Inline nodes are freed immediately, which is not safe while
+  // concurrent readers may still be looking at them.
+  if (list->inline_used != CL_INLINE_FULL
+      && !(list->flags & CL_FLAG_READ_MOSTLY)) {
+    int slot = __builtin_ctz(~list->inline_used);
+    list->inline_used |= 1u << slot;
+    new = &list->inline_nodes[slot];
+    _CL_STAT_ADD(list, inline_allocs, 1);
+  } else {
+    new = (struct _cl_node*) list->allocator->alloc(sizeof(struct _cl_node),
+                                                    list->allocator->ctx);
+  }
+
+  assert(new);
+  _CL_STAT_ADD(list, allocs, 1);
+  list->version++;
+
+  new->element = element;
+  new->next = next;
+
+  return new;
+}
+
+
+
+/*
+ * Return true if node is one of list's inline nodes
+ */
+static bool _CL_is_inline(CList list, struct _cl_node *node)
+{
+  return node >= list->inline_nodes
+    && node < list->inline_nodes + CL_INLINE_NODES;
+}
+
+
+
+/*
+ * Release a node obtained from _CL_new_node for the same list
+ *
+ * Parameters:
+ *   list   the list which owns the node
+ *   node   the node, which must already be unlinked
+ * 
+ * Returns: None
+ */
+static void _CL_free_node(CList list, struct _cl_node *node)
+{
+  _CL_STAT_ADD(list, frees, 1);
+  list->version++;
+
+  if (_CL_is_inline(list, node))
+    list->inline_used &= ~(1u << (node - list->inline_nodes));
+  else if (list->flags & CL_FLAG_READ_MOSTLY)
+    _CL_retire(node);
+  else
+    list->allocator->free(node, sizeof(struct _cl_node), list->allocator->ctx);
+}
+
+
+
+/*
+ * Transfer one node from src to dst. The node is returned as is if dst
+ * can own it; if it is one of src's inline nodes, or the lists use
+ * different allocators, it is replaced by a new node owned by dst.
+ *
+ * Parameters:
+ *   dst    the list which will take ownership of the node
+ *   src    the list which owns the node
+ *   node   the node, which must already be unlinked from src
+ * 
+ * Returns: The node to link into dst
+ */
+static struct _cl_node *_CL_adopt_node(CList dst, CList src, struct _cl_node *node)
+{
+  if (dst->allocator == src->allocator && !_CL_is_inline(src, node))
+    return node;
+
+  struct _cl_node *new = _CL_new_node(dst, node->element, node->next);
+  _CL_free_node(src, node);
+
+  return new;
+}
+
+
+
+/*
+ * Forget the list's finger and invalidate every thread's cursor on it,
+ * after its nodes have been rearranged
+ */
+static void _CL_reset_fingers(CList list)
+{
+  list->finger_node = NULL;
+  list->version++;
+}
+
+
+
+/*
+ * Find the node at pos without changing the list, starting from
+ * whichever of the list's finger and this thread's cursor lies
+ * closest at or before pos
+ *
+ * Parameters:
+ *   list    the list
+ *   pos     the position, 0 <= pos < length
+ *   walked  set to the number of links followed
+ * 
+ * Returns: The node at pos
+ */
+static struct _cl_node *_CL_find(CList list, int64_t pos, int64_t *walked)
+{
+  struct _cl_node *node = list->head;
+  int64_t i = 0;
+
+  if (list->finger_node != NULL && list->finger_pos <= pos) {
+    node = list->finger_node;
+    i = list->finger_pos;
+  }
+  if (_CL_cursor.list == list && _CL_cursor.version == list->version
+      && _CL_cursor.pos <= pos && _CL_cursor.pos > i) {
+    node = _CL_cursor.node;
+    i = _CL_cursor.pos;
+  }
+  *walked = pos - i;
+
+  for (; i < pos; i++)
+    node = node->next;
+
+  return node;
+}
+
+
+
+/*
+ * Find the node at pos as _CL_find does, and move the list's finger
+ * there. Only writers may call this.
+ */
+static struct _cl_node *_CL_seek(CList list, int64_t pos, int64_t *walked)
+{
+  struct _cl_node *node = _CL_find(list, pos, walked);
+
+  list->finger_node = node;
+  list->finger_pos = pos;
+
+  return node;
+}
+
+
+
+/*
+ * Detach the node chain from src so that it can be linked into
+ * dst. Any of src's inline nodes are replaced by nodes owned by dst,
+ * since they cannot outlive src. If the lists use different
+ * allocators, every node is replaced. Any storage that src's elements
+ * live in is handed over as well. src is left empty.
+ *
+ * Parameters:
+ *   dst    the list which will take ownership of the chain
+ *   src    the list to take the chain from
+ * 
+ * Returns: The head of the detached chain
+ */
+static struct _cl_node *_CL_take_chain(CList dst, CList src)
+{
+  struct _cl_node *head = src->head;
+
+  if (src->inline_used != 0 || dst->allocator != src->allocator) {
+    for (struct _cl_node **link = &head; *link != NULL; link = &(*link)->next)
+      *link = _CL_adopt_node(dst, src, *link);
+  }
+
+  // The elements may point into src's storage, so dst takes that too
+  if (src->storage != NULL) {
+    struct _cl_storage **link = &src->storage;
+    while (*link != NULL)
+      link = &(*link)->next;
+    *link = dst->storage;
+    dst->storage = src->storage;
+    src->storage = NULL;
+  }
+
+  src->head = NULL;
+  src->length = 0;
+  _CL_reset_fingers(src);
+
+  return head;
+}
+
+
+
+/*
+ * Set up an empty list in already-allocated header memory
+ */
+static void _CL_init_header(CList list, const CListAllocator *allocator,
+                            unsigned int flags)
+{
+  list->head = NULL;
+  list->length = 0;
+  list->flags = flags;
+  list->finger_node = NULL;
+  list->version = __atomic_fetch_add(&_CL_next_version, 1ULL << 32, __ATOMIC_RELAXED);
+  list->allocator = allocator;
+  list->storage = NULL;
+  list->heap = NULL;
+  list->heap_len = list->heap_cap = 0;
+  list->inline_used = 0;
+#ifdef CL_STATS
+  memset(&list->stats, 0, sizeof(list->stats));
+#endif
+}
+
+
+
+/*
+ * Add an element to a priority-queue list's heap
+ */
+static void _CL_heap_push(CList list, CListElementType element)
+{
+  if (list->heap_len == list->heap_cap) {
+    list->heap_cap = list->heap_cap ? 2 * list->heap_cap : 64;
+    list->heap = realloc(list->heap, list->heap_cap * sizeof(CListElementType));
+    assert(list->heap);
+  }
+
+  // Sift up: move parents down until element's slot is found
+  CListElementType *heap = list->heap;
+  int64_t i = list->heap_len++;
+  while (i > 0) {
+    int64_t parent = (i - 1) / CL_HEAP_ARITY;
+    if (strcmp(heap[parent], element) <= 0)
+      break;
+    heap[i] = heap[parent];
+    i = parent;
+  }
+  heap[i] = element;
+}
+
+
+
+/*
+ * Remove the least element from a priority-queue list's heap, which
+ * must not be empty
+ */
+static CListElementType _CL_heap_pop(CList list)
+{
+  CListElementType *heap = list->heap;
+  CListElementType top = heap[0];
+  CListElementType last = heap[--list->heap_len];
+  int64_t n = list->heap_len;
+
+  // Sift down: move the least child up until last's slot is found
+  int64_t i = 0;
+  for (;;) {
+    int64_t first = CL_HEAP_ARITY * i + 1;
+    if (first >= n)
+      break;
+
+    int64_t least = first;
+    int64_t end = (first + CL_HEAP_ARITY < n) ? first + CL_HEAP_ARITY : n;
+    for (int64_t c = first + 1; c < end; c++)
+      if (strcmp(heap[c], heap[least]) < 0)
+        least = c;
+    if (strcmp(last, heap[least]) <= 0)
+      break;
+
+    heap[i] = heap[least];
+    i = least;
+  }
+  heap[i] = last;
+
+  return top;
+}
+
+
+
+/*
+ * Move the heap of a priority-queue list into its chain, so that
+ * operations other than CL_insert_sorted and CL_pop see a plain list.
+ * The heap is drained in order and merged into the chain, each
+ * element going before the first chain element not less than it, as
+ * CL_insert_sorted would put it. Costs O(k log k + n) for k heap
+ * elements, and nothing when the heap is empty.
+ */
+static void _CL_settle(CList list)
+{
+  if (list->heap_len == 0)
+    return;
+
+  struct _cl_node **link = &list->head;
+  int64_t added = list->heap_len;
+  while (list->heap_len > 0) {
+    CListElementType element = _CL_heap_pop(list);
+    while (*link != NULL && strcmp(element, (*link)->element) > 0)
+      link = &(*link)->next;
+    *link = _CL_new_node(list, element, *link);
+    link = &(*link)->next;
+  }
+
+  list->length += added;
+  _CL_reset_fingers(list);
+  _CL_STAT_PEAK(list);
+}
+
+
+
+// Documented in .h file
+CList CL_new()
+{
+  return CL_new_with_allocator(&CL_malloc_allocator);
+}
+
+
+
+// Documented in .h file
+CList CL_new_with_allocator(const CListAllocator *allocator)
+{
+  assert(allocator);
+
+  CList list = (CList) allocator->alloc(sizeof(struct _clist), allocator->ctx);
+  assert(list);
+
+  _CL_init_header(list, allocator, 0);
+
+  return list;
+}
+
+
+
+// Documented in .h file
+CList CL_init(CListStorage *storage)
+{
+  assert(storage);
+
+  CList list = (CList) storage;
+  _CL_init_header(list, &CL_malloc_allocator, CL_FLAG_CALLER_STORAGE);
+
+  return list;
+}
+
+
+
+// Documented in .h file
+CList CL_new_read_mostly()
+{
+  // Retired nodes are released with free(), so the list must use
+  // the malloc allocator.
+  CList list = CL_new();
+  list->flags |= CL_FLAG_READ_MOSTLY;
+
+  return list;
+}
+
+
+
+// Documented in .h file
+CList CL_new_priority_queue()
+{
+  CList list = CL_new();
+  list->flags |= CL_FLAG_QUEUE;
+
+  return list;
+}
+
+
+
+// Documented in .h file
+void CL_free(CList list)
+{
+    // If the list is NULL, there is nothing to free.
+    if (list == NULL)
+        return;
+
+    // Traverse the list and free each node. No reader may be using a
+    // read-mostly list by now, so its nodes need not be retired.
+    bool direct = (list->flags & CL_FLAG_READ_MOSTLY) != 0;
+    struct _cl_node *current = list->head;
+    while (current != NULL)
+    {
+        struct _cl_node *next_node = current->next; // Store reference to the next node.
+        if (direct) {
+            _CL_STAT_ADD(list, frees, 1);
+            free(current);
+        } else
+            _CL_free_node(list, current);           // Free the current node.
+        current = next_node;                        // Move to the next node.
+    }
+
+    free(list->heap);
+    list->heap = NULL;
+    list->heap_len = list->heap_cap = 0;
+
+    // Release any storage the elements lived in.
+    while (list->storage != NULL) {
+        struct _cl_storage *storage = list->storage;
+        list->storage = storage->next;
+        munmap(storage->addr, storage->len);
+        free(storage);
+    }
+
+    // Free the list structure itself, unless it belongs to the caller.
+    if (list->flags & CL_FLAG_CALLER_STORAGE)
+        list->head = NULL;
+    else
+        list->allocator->free(list, sizeof(struct _clist), list->allocator->ctx);
+}
+
+
+
+
+/*
+ * Background reclaimer for CL_free_deferred. Lists are queued, and a
+ * single thread, started on first use, calls CL_free on each.
+ */
+struct _cl_deferred {
+  CList list;
+  struct _cl_deferred *next;
+};
+
+static struct _cl_deferred *_CL_deferred_head, **_CL_deferred_tail = &_CL_deferred_head;
+static int _CL_deferred_busy;           // a list is being freed right now
+static pthread_mutex_t _CL_deferred_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _CL_deferred_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t _CL_deferred_idle = PTHREAD_COND_INITIALIZER;
+static pthread_once_t _CL_deferred_once = PTHREAD_ONCE_INIT;
+
+static void *_CL_reclaimer_thread(void *unused)
+{
+  (void) unused;
+
+  pthread_mutex_lock(&_CL_deferred_lock);
+  for (;;) {
+    while (_CL_deferred_head == NULL) {
+      pthread_cond_broadcast(&_CL_deferred_idle);
+      pthread_cond_wait(&_CL_deferred_work, &_CL_deferred_lock);
+    }
+
+    struct _cl_deferred *item = _CL_deferred_head;
+    _CL_deferred_head = item->next;
+    if (_CL_deferred_head == NULL)
+      _CL_deferred_tail = &_CL_deferred_head;
+    _CL_deferred_busy = 1;
+    pthread_mutex_unlock(&_CL_deferred_lock);
+
+    CL_free(item->list);
+    free(item);
+
+    pthread_mutex_lock(&_CL_deferred_lock);
+    _CL_deferred_busy = 0;
+  }
+
+  return NULL;
+}
+
+static void _CL_start_reclaimer(void)
+{
+  pthread_t thread;
+  pthread_create(&thread, NULL, _CL_reclaimer_thread, NULL);
+  pthread_detach(thread);
+}
+
+
+
+// Documented in .h file
+void CL_free_deferred(CList list)
+{
+    if (list == NULL)
+        return;
+
+    // The header of a caller-storage list, which holds the inline
+    // nodes, cannot outlive this call. A caller's own allocator need
+    // not be thread-safe, so it is only called from the caller's thread.
+    if ((list->flags & CL_FLAG_CALLER_STORAGE)
+        || (list->allocator != &CL_malloc_allocator
+            && list->allocator != &CL_thread_cache_allocator)) {
+        CL_free(list);
+        return;
+    }
+
+    struct _cl_deferred *item = malloc(sizeof(struct _cl_deferred));
+    assert(item);
+    item->list = list;
+    item->next = NULL;
+
+    pthread_once(&_CL_deferred_once, _CL_start_reclaimer);
+
+    pthread_mutex_lock(&_CL_deferred_lock);
+    *_CL_deferred_tail = item;
+    _CL_deferred_tail = &item->next;
+    pthread_cond_signal(&_CL_deferred_work);
+    pthread_mutex_unlock(&_CL_deferred_lock);
+}
+
+
+
+// Documented in .h file
+void CL_free_deferred_wait(void)
+{
+    pthread_mutex_lock(&_CL_deferred_lock);
+    while (_CL_deferred_head != NULL || _CL_deferred_busy)
+        pthread_cond_wait(&_CL_deferred_idle, &_CL_deferred_lock);
+    pthread_mutex_unlock(&_CL_deferred_lock);
+}
+
+
+
+// Documented in .h file
+bool CL_free_step(CList list, int budget)
+{
+    assert(list);
+    assert(budget > 0);
+
+    _CL_reset_fingers(list);
+    for (int i = 0; i < budget && list->head != NULL; i++) {
+        struct _cl_node *node = list->head;
+        list->head = node->next;
+        list->length--;
+        _CL_free_node(list, node);
+    }
+
+    if (list->head != NULL)
+        return false;
+
+    CL_free(list);
+    return true;
+}
+
+
+
+
+// Documented in .h file
+int CL_length(CList list)
+{
+  int64_t length = CL_length64(list);
+  assert(length <= INT_MAX);
+
+  return length;
+}
+
+
+
+// Documented in .h file
+int64_t CL_length64(CList list)
+{
+  assert(list);
+#ifdef DEBUG
+  // In production code, we simply return the stored value for
+  // length. However, as a defensive programming method to prevent
+  // bugs in our code, in DEBUG mode we walk the list and ensure the
+  // number of elements on the list is equal to the stored length.
+  // (A read-mostly list may change under us, so it is not checked.)
+
+  if (!(list->flags & CL_FLAG_READ_MOSTLY)) {
+    int64_t len = 0;
+    for (struct _cl_node *node = list->head; node != NULL; node = node->next) {
+      // The finger, if any, must still be at the position it records
+      if (node == list->finger_node)
+        assert(len == list->finger_pos);
+      len++;
+    }
+
+    assert(len == list->length);
+    assert(list->finger_node == NULL || list->finger_pos < len);
+  }
+#endif // DEBUG
+
+  return _CL_READ(list->length) + list->heap_len;
+}
+
+
+
+// Documented in .h file
+void CL_print(CList list)
+{
+  assert(list);
+
+  _CL_settle(list);
+
+  long long num = 0;
+  for (struct _cl_node *node = _CL_READ(list->head); node != NULL; node = _CL_READ(node->next))
+    printf("  [%lld]: %s\n", num++, node->element);
+}
+
+
+
+// Documented in .h file
+void CL_push(CList list, CListElementType element)
+{
+  assert(list);
+  _CL_settle(list);
+  _CL_PUBLISH(list->head, _CL_new_node(list, element, list->head));
+  _CL_PUBLISH(list->length, list->length + 1);
+  list->finger_pos++;
+  _CL_STAT_PEAK(list);
+}
+
+
+
+// Documented in .h file
+CListElementType CL_pop(CList list)
+{
+  assert(list);
+
+  struct _cl_node *popped_node = list->head;
+
+  // A priority-queue list's least element is the smaller of the chain
+  // head and the heap top; on a tie, the heap's was inserted later, so
+  // it comes first.
+  if (list->heap_len > 0
+      && (popped_node == NULL || strcmp(list->heap[0], popped_node->element) <= 0))
+    return _CL_heap_pop(list);
+
+  if (popped_node == NULL)
+    return INVALID_RETURN;
+
+  CListElementType ret = popped_node->element;
+
+  // unlink previous head node, then free it
+  _CL_PUBLISH(list->head, popped_node->next);
+  _CL_PUBLISH(list->length, list->length - 1);
+  if (list->finger_node == popped_node)
+    list->finger_node = NULL;
+  list->finger_pos--;
+  _CL_free_node(list, popped_node);
+  // we cannot refer to popped node any longer
+
+  return ret;
+}
+
+
+
+// Documented in .h file
+void CL_append(CList list, CListElementType element)
+{
+    assert(list);  // Ensure the list is valid
+    _CL_settle(list);
+
+    struct _cl_node *new_node = _CL_new_node(list, element, NULL);
+    assert(new_node);
+    _CL_STAT_ADD(list, append_calls, 1);
+
+    if (list->head == NULL) {
+        // If the list is empty, the new node is the head.
+        _CL_PUBLISH(list->head, new_node);
+    } else {
+        // Traverse to the end of the list and insert the new node.
+        struct _cl_node *current = list->head;
+        while (current->next != NULL) {
+            current = current->next;
+        }
+        _CL_PUBLISH(current->next, new_node);
+        _CL_STAT_ADD(list, append_slow, 1);
+        _CL_STAT_ADD(list, append_walked, list->length - 1);
+    }
+
+    // Increment the length of the list.
+    _CL_PUBLISH(list->length, list->length + 1);
+    _CL_STAT_PEAK(list);
+}
+// Documented in .h file
+CListElementType CL_nth(CList list, int pos)
+{
+    return CL_nth64(list, pos);
+}
+
+
+
+// Documented in .h file
+CListElementType CL_nth64(CList list, int64_t pos)
+{
+    assert(list);
+    _CL_settle(list);
+
+    int64_t length = _CL_READ(list->length);
+
+    // If position is out of range, return INVALID_RETURN.
+    if (pos < -length || pos >= length)
+        return INVALID_RETURN;
+
+    // Convert negative position to positive equivalent.
+    if (pos < 0)
+        pos = length + pos;
+
+    if (!(list->flags & CL_FLAG_READ_MOSTLY)) {
+        int64_t walked;
+        struct _cl_node *current = _CL_find(list, pos, &walked);
+        _CL_STAT_ADD(list, nth_calls, 1);
+        _CL_STAT_ADD(list, nth_walked, walked);
+
+        _CL_cursor.list = list;
+        _CL_cursor.version = list->version;
+        _CL_cursor.node = current;
+        _CL_cursor.pos = pos;
+
+        return current->element;
+    }
+
+    // A read-mostly list may have shrunk since we read its length.
+    struct _cl_node *current = _CL_READ(list->head);
+    for (int64_t i = 0; i < pos && current != NULL; i++) {
+        current = _CL_READ(current->next);
+    }
+    if (current == NULL)
+        return INVALID_RETURN;
+    _CL_STAT_ADD(list, nth_calls, 1);
+    _CL_STAT_ADD(list, nth_walked, pos);
+
+    return current->element;
+}
+// Documented in .h file
+bool CL_insert(CList list, CListElementType element, int pos)
+{
+    return CL_insert64(list, element, pos);
+}
+
+
+
+// Documented in .h file
+bool CL_insert64(CList list, CListElementType element, int64_t pos)
+{
+    assert(list);
+    _CL_settle(list);
+
+    // Check if position is out of bounds
+    if (pos < -list->length - 1 || pos > list->length)
+        return false;
+
+    // Convert negative position to positive equivalent.
+    if (pos < 0)
+        pos = list->length + pos + 1;
+
+    if (pos == 0) {
+        // Insert at the head.
+        CL_push(list, element);
+    } else {
+        // Find the node before the position where we want to insert.
+        // The finger is left there, and positions up to it are
+        // unaffected by the insertion.
+        int64_t walked;
+        struct _cl_node *current = _CL_seek(list, pos - 1, &walked);
+
+        _CL_STAT_ADD(list, insert_walked, walked);
+
+        // Insert the new node.
+        struct _cl_node *new_node = _CL_new_node(list, element, current->next);
+        _CL_PUBLISH(current->next, new_node);
+
+        _CL_PUBLISH(list->length, list->length + 1);
+        _CL_STAT_PEAK(list);
+    }
+    _CL_STAT_ADD(list, insert_calls, 1);
+
+    return true;
+}
+// Documented in .h file
+CListElementType CL_remove(CList list, int pos)
+{
+    return CL_remove64(list, pos);
+}
+
+
+
+// Documented in .h file
+CListElementType CL_remove64(CList list, int64_t pos)
+{
+    assert(list);
+    _CL_settle(list);
+
+    // Check if position is out of bounds
+    if (pos < -list->length || pos >= list->length)
+        return INVALID_RETURN;
+
+    // Convert negative position to positive equivalent.
+    if (pos < 0)
+        pos = list->length + pos;
+
+    CListElementType removed_element;
+
+    if (pos == 0) {
+        // Remove the head element.
+        removed_element = CL_pop(list);
+    } else {
+        // Find the node before the one we want to remove, leaving the
+        // finger there as for CL_insert.
+        int64_t walked;
+        struct _cl_node *current = _CL_seek(list, pos - 1, &walked);
+
+        _CL_STAT_ADD(list, remove_walked, walked);
+
+        struct _cl_node *node_to_remove = current->next;
+        removed_element = node_to_remove->element;
+        _CL_PUBLISH(current->next, node_to_remove->next);
+        _CL_PUBLISH(list->length, list->length - 1);
+
+        _CL_free_node(list, node_to_remove);
+    }
+    _CL_STAT_ADD(list, remove_calls, 1);
+
+    return removed_element;
+}
+// Documented in .h file
+CList CL_copy(CList src_list)
+{
+    assert(src_list);
+    _CL_settle(src_list);
+
+    CList new_list = CL_new();
+
+    struct _cl_node *current = _CL_READ(src_list->head);
+    struct _cl_node **tail = &new_list->head;
+
+    // Traverse the source list and append each element to the new
+    // list, remembering the tail so that each append is O(1). The
+    // nodes are counted, since a read-mostly source may be changing.
+    while (current != NULL) {
+        *tail = _CL_new_node(new_list, current->element, NULL);
+        tail = &(*tail)->next;
+        new_list->length++;
+        current = _CL_READ(current->next);
+    }
+    _CL_STAT_PEAK(new_list);
+
+    return new_list;
+}
+// Documented in .h file
+int CL_insert_sorted(CList list, CListElementType element)
+{
+    int64_t pos = CL_insert_sorted64(list, element);
+    if (pos == CL_NO_POSITION64)
+        return CL_NO_POSITION;
+    assert(pos <= INT_MAX);
+
+    return pos;
+}
+
+
+
+// Documented in .h file
+int64_t CL_insert_sorted64(CList list, CListElementType element)
+{
+    assert(list);
+
+    if (list->flags & CL_FLAG_QUEUE) {
+        _CL_heap_push(list, element);
+        return CL_NO_POSITION64;
+    }
+
+    struct _cl_node *prev = NULL, *current = list->head;
+    int64_t pos = 0;
+
+    // Traverse until we find the appropriate position.
+    while (current != NULL && strcmp(element, current->element) > 0) {
+        prev = current;
+        current = current->next;
+        pos++;
+    }
+
+    // Link the new node in after prev. Going through CL_insert64 would
+    // walk to it a second time.
+    if (prev == NULL) {
+        CL_push(list, element);
+    } else {
+        _CL_STAT_ADD(list, insert_walked, pos - 1);
+        _CL_PUBLISH(prev->next, _CL_new_node(list, element, current));
+        _CL_PUBLISH(list->length, list->length + 1);
+
+        // As after CL_insert64, the finger is left before the new node
+        list->finger_node = prev;
+        list->finger_pos = pos - 1;
+        _CL_STAT_PEAK(list);
+    }
+    _CL_STAT_ADD(list, insert_calls, 1);
+
+    return pos;
+}
+
+
+// Documented in .h file
+void CL_join(CList list1, CList list2)
+{
+    assert(list1);
+    assert(list2);
+    _CL_settle(list1);
+    _CL_settle(list2);
+
+    if (list2->head == NULL)
+        return;  // list2 is empty, nothing to do.
+
+    // Take list2's nodes; this also leaves list2 empty.
+    int64_t length2 = list2->length;
+    struct _cl_node *head2 = _CL_take_chain(list1, list2);
+
+    if (list1->head == NULL) {
+        // If list1 is empty, just set list1->head to list2's chain.
+        _CL_PUBLISH(list1->head, head2);
+    } else {
+        // Traverse to the end of list1.
+        struct _cl_node *current = list1->head;
+        while (current->next != NULL) {
+            current = current->next;
+        }
+
+        // Link list2 at the end of list1.
+        _CL_PUBLISH(current->next, head2);
+    }
+
+    // Update length of list1.
+    _CL_PUBLISH(list1->length, list1->length + length2);
+}
+
+
+// Documented in .h file
+void CL_reverse(CList list)
+{
+    assert(list);
+    _CL_settle(list);
+
+    struct _cl_node *prev = NULL, *current = list->head, *next = NULL;
+
+    _CL_reset_fingers(list);
+
+    while (current != NULL) {
+        next = current->next;  // Store reference to next node.
+        current->next = prev;  // Reverse the link.
+        prev = current;        // Move `prev` to current node.
+        current = next;        // Move `current` to next node.
+    }
+
+    list->head = prev;  // Update the head of the list.
+}
+
+
+
+// Documented in .h file
+void CL_foreach(CList list, CL_foreach_callback callback, void *cb_data)
+{
+    assert(list);
+    assert(callback);
+    _CL_settle(list);
+
+    struct _cl_node *current = _CL_READ(list->head);
+    int pos = 0;
+
+    while (current != NULL) {
+        callback(pos, current->element, cb_data);
+        current = _CL_READ(current->next);
+        assert(pos < INT_MAX);
+        pos++;
+    }
+}
+
+
+
+// Documented in .h file
+void CL_foreach64(CList list, CL_foreach64_callback callback, void *cb_data)
+{
+    assert(list);
+    assert(callback);
+    _CL_settle(list);
+
+    struct _cl_node *current = _CL_READ(list->head);
+    int64_t pos = 0;
+
+    while (current != NULL) {
+        callback(pos, current->element, cb_data);
+        current = _CL_READ(current->next);
+        pos++;
+    }
+}
+
+
+
+// Documented in .h file
+CList CL_from_file(const char *path, char delimiter)
+{
+    assert(path);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    CList list = CL_new();
+    size_t size = st.st_size;
+    if (size == 0) {
+        close(fd);
+        return list;
+    }
+
+    // Reserve the file's pages plus one spare anonymous page, then map
+    // the file privately over the start. Writes only touch our private
+    // copy, and the zero byte just past the end of the file is always
+    // ours to use as the last element's terminator.
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t len = (size + page - 1) / page * page + page;
+    char *data = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED
+        || mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0)
+           == MAP_FAILED) {
+        if (data != MAP_FAILED)
+            munmap(data, len);
+        close(fd);
+        CL_free(list);
+        return NULL;
+    }
+    close(fd);
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    struct _cl_storage *storage = malloc(sizeof(struct _cl_storage));
+    assert(storage);
+    storage->addr = data;
+    storage->len = len;
+    storage->next = NULL;
+    list->storage = storage;
+
+    // Split on the delimiter; memchr is vectorized in the C library. A
+    // delimiter at the very end does not start another element.
+    struct _cl_node **tail = &list->head;
+    char *start = data;
+    char *end = data + size;
+    while (start < end) {
+        char *stop = memchr(start, delimiter, end - start);
+        if (stop == NULL)
+            stop = end;
+        *stop = '\0';
+
+        *tail = _CL_new_node(list, start, NULL);
+        tail = &(*tail)->next;
+        list->length++;
+
+        start = stop + 1;
+    }
+    _CL_STAT_PEAK(list);
+
+    return list;
+}
+
+
+// Documented in .h file
+int CL_remove_if(CList list, CL_predicate predicate, void *cb_data)
+{
+    int64_t removed = CL_remove_if64(list, predicate, cb_data);
+    assert(removed <= INT_MAX);
+
+    return removed;
+}
+
+
+
+// Documented in .h file
+int64_t CL_remove_if64(CList list, CL_predicate predicate, void *cb_data)
+{
+    assert(list);
+    assert(predicate);
+    _CL_settle(list);
+
+    int64_t removed = 0;
+    struct _cl_node **link = &list->head;
+
+    _CL_reset_fingers(list);
+    while (*link != NULL) {
+        struct _cl_node *node = *link;
+        if (predicate(node->element, cb_data)) {
+            _CL_PUBLISH(*link, node->next);
+            _CL_free_node(list, node);
+            removed++;
+        } else {
+            link = &node->next;
+        }
+    }
+
+    _CL_PUBLISH(list->length, list->length - removed);
+
+    return removed;
+}
+
+
+
+// Documented in .h file
+int CL_partition(CList list, CL_predicate predicate, void *cb_data, CList out_list)
+{
+    int64_t moved = CL_partition64(list, predicate, cb_data, out_list);
+    assert(moved <= INT_MAX);
+
+    return moved;
+}
+
+
+
+// Documented in .h file
+int64_t CL_partition64(CList list, CL_predicate predicate, void *cb_data, CList out_list)
+{
+    assert(list);
+    assert(predicate);
+    assert(out_list);
+    assert(list != out_list);
+    _CL_settle(list);
+    _CL_settle(out_list);
+
+    // Find the end of out_list, where matches will be appended
+    struct _cl_node **out_tail = &out_list->head;
+    while (*out_tail != NULL)
+        out_tail = &(*out_tail)->next;
+
+    int64_t moved = 0;
+    struct _cl_node **link = &list->head;
+
+    _CL_reset_fingers(list);
+
+    while (*link != NULL) {
+        struct _cl_node *node = *link;
+        if (predicate(node->element, cb_data)) {
+            _CL_PUBLISH(*link, node->next);
+            node = _CL_adopt_node(out_list, list, node);
+            node->next = NULL;
+            _CL_PUBLISH(*out_tail, node);
+            out_tail = &node->next;
+            moved++;
+        } else {
+            link = &node->next;
+        }
+    }
+
+    _CL_PUBLISH(list->length, list->length - moved);
+    _CL_PUBLISH(out_list->length, out_list->length + moved);
+    _CL_STAT_PEAK(out_list);
+
+    return moved;
+}
+
+
+/*
+ * FNV-1a hash of a string
+ */
+static uint64_t _CL_hash(const char *str)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (const unsigned char *p = (const unsigned char *) str; *p != '\0'; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+
+
+// Documented in .h file
+int CL_dedup(CList list)
+{
+    int64_t removed = CL_dedup64(list);
+    assert(removed <= INT_MAX);
+
+    return removed;
+}
+
+
+
+// Documented in .h file
+int64_t CL_dedup64(CList list)
+{
+    assert(list);
+    _CL_settle(list);
+
+    if (list->length < 2)
+        return 0;
+
+    // Open-addressing set of the elements kept so far, with linear
+    // probing. Keeping the table at most half full bounds the probes.
+    struct _cl_slot {
+        uint64_t hash;
+        CListElementType element;       // NULL marks an empty slot
+    };
+
+    size_t size = 16;
+    while (size < 2 * (size_t) list->length)
+        size *= 2;
+    struct _cl_slot *table = calloc(size, sizeof(struct _cl_slot));
+    assert(table);
+
+    int64_t removed = 0;
+    struct _cl_node **link = &list->head;
+    _CL_reset_fingers(list);
+    while (*link != NULL) {
+        struct _cl_node *node = *link;
+        uint64_t hash = _CL_hash(node->element);
+
+        size_t i = hash & (size - 1);
+        while (table[i].element != NULL
+               && (table[i].hash != hash || strcmp(table[i].element, node->element) != 0))
+            i = (i + 1) & (size - 1);
+
+        if (table[i].element == NULL) {
+            // First occurrence: keep it
+            table[i].hash = hash;
+            table[i].element = node->element;
+            link = &node->next;
+        } else {
+            // Duplicate: unlink and free it
+            _CL_PUBLISH(*link, node->next);
+            _CL_free_node(list, node);
+            removed++;
+        }
+    }
+
+    free(table);
+    _CL_PUBLISH(list->length, list->length - removed);
+
+    return removed;
+}
+
+
+
+// Documented in .h file
+int CL_unique_sorted(CList list)
+{
+    int64_t removed = CL_unique_sorted64(list);
+    assert(removed <= INT_MAX);
+
+    return removed;
+}
+
+
+
+// Documented in .h file
+int64_t CL_unique_sorted64(CList list)
+{
+    assert(list);
+    _CL_settle(list);
+
+    int64_t removed = 0;
+    struct _cl_node *kept = list->head;
+
+    _CL_reset_fingers(list);
+
+    while (kept != NULL && kept->next != NULL) {
+        struct _cl_node *node = kept->next;
+        if (strcmp(kept->element, node->element) == 0) {
+            _CL_PUBLISH(kept->next, node->next);
+            _CL_free_node(list, node);
+            removed++;
+        } else {
+            kept = node;
+        }
+    }
+
+    _CL_PUBLISH(list->length, list->length - removed);
+
+    return removed;
+}
+
+
+/*
+ * Merge two sorted chains into one, ordered by strcmp. The merge is
+ * stable: on ties, nodes from a come before nodes from b.
+ *
+ * Parameters:
+ *   a, b   the chains to merge, which are consumed
+ * 
+ * Returns: The head of the merged chain
+ */
+static struct _cl_node *_CL_merge_chains(struct _cl_node *a, struct _cl_node *b)
+{
+    struct _cl_node *head = NULL;
+    struct _cl_node **tail = &head;
+
+    while (a != NULL && b != NULL) {
+        if (strcmp(a->element, b->element) <= 0) {
+            *tail = a;
+            a = a->next;
+        } else {
+            *tail = b;
+            b = b->next;
+        }
+        tail = &(*tail)->next;
+    }
+    *tail = (a != NULL) ? a : b;
+
+    return head;
+}
+
+
+
+/*
+ * Stable bottom-up merge sort of a NULL-terminated chain. bins[i]
+ * holds a sorted run of 2^i nodes (or is empty); runs in higher bins
+ * always precede runs in lower bins in the original order.
+ *
+ * Parameters:
+ *   head   the chain to sort
+ * 
+ * Returns: The head of the sorted chain
+ */
+static struct _cl_node *_CL_sort_chain(struct _cl_node *head)
+{
+    struct _cl_node *bins[64] = { NULL };
+    int max_bin = 0;
+
+    while (head != NULL) {
+        struct _cl_node *carry = head;
+        head = head->next;
+        carry->next = NULL;
+
+        int i;
+        for (i = 0; bins[i] != NULL; i++) {
+            carry = _CL_merge_chains(bins[i], carry);
+            bins[i] = NULL;
+        }
+        bins[i] = carry;
+        if (i > max_bin)
+            max_bin = i;
+    }
+
+    struct _cl_node *result = NULL;
+    for (int i = 0; i <= max_bin; i++)
+        result = _CL_merge_chains(bins[i], result);
+
+    return result;
+}
+
+
+
+// Documented in .h file
+void CL_sort(CList list)
+{
+    assert(list);
+    _CL_settle(list);
+
+    list->head = _CL_sort_chain(list->head);
+    _CL_reset_fingers(list);
+}
+
+
+
+// Documented in .h file
+void CL_merge_sorted(CList dst, CList src)
+{
+    assert(dst);
+    assert(src);
+    _CL_settle(dst);
+    _CL_settle(src);
+
+    if (src->head == NULL)
+        return;
+
+    int64_t length2 = src->length;
+    struct _cl_node *head2 = _CL_take_chain(dst, src);
+
+    // src goes first so that it wins ties, as CL_insert_sorted would
+    // put each of its elements before any equal element of dst.
+    dst->head = _CL_merge_chains(head2, dst->head);
+    dst->length += length2;
+    _CL_reset_fingers(dst);
+    _CL_STAT_PEAK(dst);
+}
+
+
+
+// Don't bother starting threads for fewer nodes than this per thread
+#define CL_PARALLEL_MIN_RUN 4096
+#define CL_PARALLEL_MAX_THREADS 64
+
+// One thread's share of a parallel sort or copy
+struct _cl_run {
+    struct _cl_node *head;         // input run, then result chain
+    struct _cl_node *tail;         // result tail (copy only)
+    int64_t length;
+    const CListAllocator *allocator;
+};
+
+
+
+/*
+ * Split list into nthreads NULL-terminated runs of nearly equal
+ * length, in a single pass. The list itself is not changed, except
+ * that the chain is cut between runs when cut is true.
+ */
+static void _CL_split_runs(CList list, struct _cl_run *runs, int nthreads, bool cut)
+{
+    struct _cl_node *node = list->head;
+
+    for (int t = 0; t < nthreads; t++) {
+        runs[t].head = node;
+        runs[t].length = list->length / nthreads + (t < list->length % nthreads);
+
+        struct _cl_node *last = NULL;
+        for (int64_t i = 0; i < runs[t].length; i++) {
+            last = node;
+            node = node->next;
+        }
+        if (cut && last != NULL)
+            last->next = NULL;
+    }
+}
+
+
+
+/*
+ * Clamp a requested thread count for a list of the given length;
+ * returns 1 if the work should be done serially.
+ */
+static int _CL_parallel_threads(int64_t length, int nthreads)
+{
+    if (nthreads > CL_PARALLEL_MAX_THREADS)
+        nthreads = CL_PARALLEL_MAX_THREADS;
+    if (nthreads > length / CL_PARALLEL_MIN_RUN)
+        nthreads = length / CL_PARALLEL_MIN_RUN;
+
+    return (nthreads < 1) ? 1 : nthreads;
+}
+
+
+
+static void *_CL_sort_run_thread(void *arg)
+{
+    struct _cl_run *run = arg;
+    run->head = _CL_sort_chain(run->head);
+    return NULL;
+}
+
+static void *_CL_merge_runs_thread(void *arg)
+{
+    struct _cl_run *runs = arg;
+    runs[0].head = _CL_merge_chains(runs[0].head, runs[1].head);
+    return NULL;
+}
+
+
+
+// Documented in .h file
+void CL_sort_parallel(CList list, int nthreads)
+{
+    assert(list);
+    _CL_settle(list);
+
+    nthreads = _CL_parallel_threads(list->length, nthreads);
+    if (nthreads == 1) {
+        CL_sort(list);
+        return;
+    }
+
+    struct _cl_run runs[CL_PARALLEL_MAX_THREADS];
+    pthread_t threads[CL_PARALLEL_MAX_THREADS];
+
+    _CL_split_runs(list, runs, nthreads, true);
+
+    for (int t = 0; t < nthreads; t++)
+        pthread_create(&threads[t], NULL, _CL_sort_run_thread, &runs[t]);
+    for (int t = 0; t < nthreads; t++)
+        pthread_join(threads[t], NULL);
+
+    // Merge neighbouring runs pairwise, in parallel, until one is left.
+    // Always merging run t with the following run keeps the sort stable.
+    for (int step = 1; step < nthreads; step *= 2) {
+        int nmerges = 0;
+        for (int t = 0; t + step < nthreads; t += 2 * step) {
+            runs[t + 1] = runs[t + step];   // _CL_merge_runs_thread wants a pair
+            pthread_create(&threads[nmerges++], NULL, _CL_merge_runs_thread, &runs[t]);
+        }
+        for (int i = 0; i < nmerges; i++)
+            pthread_join(threads[i], NULL);
+    }
+
+    list->head = runs[0].head;
+    _CL_reset_fingers(list);
+}
+
+
+
+static void *_CL_copy_run_thread(void *arg)
+{
+    struct _cl_run *run = arg;
+    const CListAllocator *allocator = run->allocator;
+    struct _cl_node *src = run->head;
+    struct _cl_node **tail = &run->head;
+
+    run->tail = NULL;
+    for (int64_t i = 0; i < run->length; i++) {
+        struct _cl_node *node = allocator->alloc(sizeof(struct _cl_node), allocator->ctx);
+        assert(node);
+        node->element = src->element;
+        *tail = run->tail = node;
+        tail = &node->next;
+        src = src->next;
+    }
+    *tail = NULL;
+
+    return NULL;
+}
+
+
+
+// Documented in .h file
+CList CL_copy_parallel(CList src_list, int nthreads)
+{
+    assert(src_list);
+    _CL_settle(src_list);
+
+    nthreads = _CL_parallel_threads(src_list->length, nthreads);
+    if (nthreads == 1)
+        return CL_copy(src_list);
+
+    CList new_list = CL_new();
+
+    struct _cl_run runs[CL_PARALLEL_MAX_THREADS];
+    pthread_t threads[CL_PARALLEL_MAX_THREADS];
+
+    _CL_split_runs(src_list, runs, nthreads, false);
+
+    // Workers allocate straight from the allocator, bypassing the
+    // inline nodes, whose bookkeeping is not thread-safe.
+    for (int t = 0; t < nthreads; t++) {
+        runs[t].allocator = new_list->allocator;
+        pthread_create(&threads[t], NULL, _CL_copy_run_thread, &runs[t]);
+    }
+    for (int t = 0; t < nthreads; t++)
+        pthread_join(threads[t], NULL);
+
+    // Stitch the copied runs together
+    new_list->head = runs[0].head;
+    for (int t = 0; t + 1 < nthreads; t++)
+        runs[t].tail->next = runs[t + 1].head;
+    new_list->length = src_list->length;
+    _CL_STAT_ADD(new_list, allocs, new_list->length);
+    _CL_STAT_PEAK(new_list);
+
+    return new_list;
+}
+
+
+/*
+ * Concurrent sorted list, after Harris, "A Pragmatic Implementation of
+ * Non-Blocking Linked-Lists". The low bit of a node's next pointer
+ * marks the node as logically deleted; marked nodes are then unlinked
+ * with CAS by whichever thread gets there first, and retired through
+ * the same epoch-based reclamation as read-mostly lists. Every
+ * operation runs inside a read-side section, so a node cannot be
+ * freed while a thread is still looking at it.
+ */
+struct _cl_cnode {
+    CListElementType element;
+    uintptr_t next;                 // struct _cl_cnode *, low bit = mark
+};
+
+struct _cl_concurrent {
+    struct _cl_cnode head;          // sentinel, sorts before everything
+    int length;
+};
+
+#define _CL_MARK          ((uintptr_t) 1)
+#define _CL_PTR(link)     ((struct _cl_cnode *) ((link) & ~_CL_MARK))
+#define _CL_MARKED(link)  (((link) & _CL_MARK) != 0)
+
+
+
+/*
+ * Find the first unmarked node right whose element is not less than
+ * element, and its unmarked predecessor left, unlinking any marked
+ * nodes in between. On return, left->next == right (unmarked).
+ *
+ * Parameters:
+ *   list      the list
+ *   element   the element to search for
+ *   left_out  set to the predecessor of the returned node
+ * 
+ * Returns: right, or NULL if there is no such node
+ */
+static struct _cl_cnode *_CL_concurrent_search(CListConcurrent list,
+                                               CListElementType element,
+                                               struct _cl_cnode **left_out)
+{
+    for (;;) {
+        struct _cl_cnode *left = &list->head;
+        uintptr_t left_next = __atomic_load_n(&left->next, __ATOMIC_ACQUIRE);
+        struct _cl_cnode *node = &list->head;
+        uintptr_t node_next = left_next;
+
+        // Walk until an unmarked node not less than element, remembering
+        // the last unmarked node seen before it.
+        do {
+            if (!_CL_MARKED(node_next)) {
+                left = node;
+                left_next = node_next;
+            }
+            node = _CL_PTR(node_next);
+            if (node == NULL)
+                break;
+            node_next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+        } while (_CL_MARKED(node_next) || strcmp(node->element, element) < 0);
+
+        struct _cl_cnode *right = node;
+
+        if (_CL_PTR(left_next) == right) {
+            if (right != NULL && _CL_MARKED(__atomic_load_n(&right->next, __ATOMIC_ACQUIRE)))
+                continue;
+            *left_out = left;
+            return right;
+        }
+
+        // Unlink the marked nodes between left and right in one go; the
+        // thread whose CAS succeeds retires them.
+        if (__atomic_compare_exchange_n(&left->next, &left_next, (uintptr_t) right,
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            struct _cl_cnode *dead = _CL_PTR(left_next);
+            while (dead != right) {
+                struct _cl_cnode *next = _CL_PTR(dead->next);
+                _CL_retire(dead);
+                dead = next;
+            }
+            if (right != NULL && _CL_MARKED(__atomic_load_n(&right->next, __ATOMIC_ACQUIRE)))
+                continue;
+            *left_out = left;
+            return right;
+        }
+    }
+}
+
+
+
+// Documented in .h file
+CListConcurrent CL_concurrent_new()
+{
+    CListConcurrent list = malloc(sizeof(struct _cl_concurrent));
+    assert(list);
+
+    list->head.element = NULL;
+    list->head.next = 0;
+    list->length = 0;
+
+    return list;
+}
+
+
+
+// Documented in .h file
+void CL_concurrent_free(CListConcurrent list)
+{
+    if (list == NULL)
+        return;
+
+    struct _cl_cnode *node = _CL_PTR(list->head.next);
+    while (node != NULL) {
+        struct _cl_cnode *next = _CL_PTR(node->next);
+        free(node);
+        node = next;
+    }
+
+    free(list);
+}
+
+
+
+// Documented in .h file
+void CL_concurrent_insert_sorted(CListConcurrent list, CListElementType element)
+{
+    assert(list);
+
+    struct _cl_cnode *new = malloc(sizeof(struct _cl_cnode));
+    assert(new);
+    new->element = element;
+
+    CL_read_lock();
+    for (;;) {
+        struct _cl_cnode *left;
+        struct _cl_cnode *right = _CL_concurrent_search(list, element, &left);
+
+        new->next = (uintptr_t) right;
+        uintptr_t expected = (uintptr_t) right;
+        if (__atomic_compare_exchange_n(&left->next, &expected, (uintptr_t) new,
+                                        false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            break;
+    }
+    CL_read_unlock();
+
+    __atomic_fetch_add(&list->length, 1, __ATOMIC_RELAXED);
+}
+
+
+
+// Documented in .h file
+bool CL_concurrent_remove(CListConcurrent list, CListElementType element)
+{
+    assert(list);
+
+    bool removed = false;
+
+    CL_read_lock();
+    for (;;) {
+        struct _cl_cnode *left;
+        struct _cl_cnode *right = _CL_concurrent_search(list, element, &left);
+
+        if (right == NULL || strcmp(right->element, element) != 0)
+            break;
+
+        // Logically delete right by marking its next pointer
+        uintptr_t right_next = __atomic_load_n(&right->next, __ATOMIC_ACQUIRE);
+        if (_CL_MARKED(right_next))
+            continue;
+        if (!__atomic_compare_exchange_n(&right->next, &right_next, right_next | _CL_MARK,
+                                         false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            continue;
+
+        removed = true;
+        __atomic_fetch_sub(&list->length, 1, __ATOMIC_RELAXED);
+
+        // Try to unlink it; if that fails, a search will clean up.
+        uintptr_t expected = (uintptr_t) right;
+        if (__atomic_compare_exchange_n(&left->next, &expected, right_next,
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            _CL_retire(right);
+        else
+            _CL_concurrent_search(list, element, &left);
+        break;
+    }
+    CL_read_unlock();
+
+    return removed;
+}
+
+
+
+// Documented in .h file
+bool CL_concurrent_contains(CListConcurrent list, CListElementType element)
+{
+    assert(list);
+
+    CL_read_lock();
+    struct _cl_cnode *left;
+    struct _cl_cnode *right = _CL_concurrent_search(list, element, &left);
+    bool found = (right != NULL && strcmp(right->element, element) == 0);
+    CL_read_unlock();
+
+    return found;
+}
+
+
+
+// Documented in .h file
+int CL_concurrent_length(CListConcurrent list)
+{
+    assert(list);
+
+    return __atomic_load_n(&list->length, __ATOMIC_RELAXED);
+}
+
+
+
+// Documented in .h file
+CList CL_concurrent_to_list(CListConcurrent list)
+{
+    assert(list);
+
+    CList result = CL_new();
+    struct _cl_node **tail = &result->head;
+
+    CL_read_lock();
+    uintptr_t link = __atomic_load_n(&list->head.next, __ATOMIC_ACQUIRE);
+    while (_CL_PTR(link) != NULL) {
+        struct _cl_cnode *node = _CL_PTR(link);
+        link = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+        if (_CL_MARKED(link))
+            continue;
+
+        *tail = _CL_new_node(result, node->element, NULL);
+        tail = &(*tail)->next;
+        result->length++;
+    }
+    CL_read_unlock();
+    _CL_STAT_PEAK(result);
+
+    return result;
+}
+
+
+/*
+ * Recency list. Nodes form a circular doubly linked chain through a
+ * sentinel, so that touching, evicting and removing need no special
+ * cases: sentinel.next is the most recently used node and
+ * sentinel.prev the least. Unlinked nodes are kept on a spare chain
+ * for reuse. When indexed, nodes are also chained into hash buckets
+ * through hash_next.
+ */
+struct _cl_lru_node {
+    CListElementType element;
+    struct _cl_lru_node *prev, *next;
+    struct _cl_lru_node *hash_next;
+    uint64_t hash;
+};
+
+struct _cl_lru {
+    struct _cl_lru_node sentinel;
+    int length;
+    struct _cl_lru_node *spare;         // linked through next
+    struct _cl_lru_node **buckets;      // NULL unless indexed
+    size_t nbuckets;                    // a power of two
 };
 
 
 
 /*
- * Create (malloc) a new _cl_node and populate it with the supplied
- * values
- *
- * Parameters:
- *   element, next  the values for the node to be created
- * 
- * Returns: The newly-malloc'd node, or NULL in case of error
+ * Double the hash table of an indexed recency list, rehashing every
+ * node. Handles are unaffected, since nodes do not move.
  */
-static struct _cl_node*
-_CL_new_node(CListElementType element, struct _cl_node *next)
+static void _CL_lru_grow(CListLRU list)
 {
-  struct _cl_node* new = (struct _cl_node*) malloc(sizeof(struct _cl_node));
+    size_t nbuckets = list->nbuckets * 2;
+    struct _cl_lru_node **buckets = calloc(nbuckets, sizeof(struct _cl_lru_node *));
+    assert(buckets);
+
+    // Walk from least to most recent, so that each bucket ends up with
+    // its most recently pushed duplicates first, as before
+    for (struct _cl_lru_node *node = list->sentinel.prev; node != &list->sentinel;
+         node = node->prev) {
+        size_t i = node->hash & (nbuckets - 1);
+        node->hash_next = buckets[i];
+        buckets[i] = node;
+    }
 
-  assert(new);
+    free(list->buckets);
+    list->buckets = buckets;
+    list->nbuckets = nbuckets;
+}
 
-  new->element = element;
-  new->next = next;
 
-  return new;
+
+/*
+ * Unlink a node from the recency chain and the hash table, and put it
+ * on the spare chain
+ *
+ * Returns: The node's element
+ */
+static CListElementType _CL_lru_unlink(CListLRU list, struct _cl_lru_node *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+
+    if (list->buckets != NULL) {
+        struct _cl_lru_node **link = &list->buckets[node->hash & (list->nbuckets - 1)];
+        while (*link != node)
+            link = &(*link)->hash_next;
+        *link = node->hash_next;
+    }
+
+    node->next = list->spare;
+    list->spare = node;
+    list->length--;
+
+    return node->element;
 }
 
 
 
 // Documented in .h file
-CList CL_new()
+CListLRU CL_lru_new(bool indexed)
 {
-  CList list = (CList) malloc(sizeof(struct _clist));
-  assert(list);
+    CListLRU list = malloc(sizeof(struct _cl_lru));
+    assert(list);
 
-  list->head = NULL;
-  list->length = 0;
+    list->sentinel.element = NULL;
+    list->sentinel.prev = list->sentinel.next = &list->sentinel;
+    list->length = 0;
+    list->spare = NULL;
+    list->buckets = NULL;
+    list->nbuckets = 0;
+
+    if (indexed) {
+        list->nbuckets = 16;
+        list->buckets = calloc(list->nbuckets, sizeof(struct _cl_lru_node *));
+        assert(list->buckets);
+    }
 
-  return list;
+    return list;
 }
 
 
 
 // Documented in .h file
-void CL_free(CList list)
+void CL_lru_free(CListLRU list)
 {
-    // If the list is NULL, there is nothing to free.
     if (list == NULL)
         return;
 
-    // Traverse the list and free each node.
-    struct _cl_node *current = list->head;
-    while (current != NULL)
-    {
-        struct _cl_node *next_node = current->next; // Store reference to the next node.
-        free(current);                              // Free the current node.
-        current = next_node;                        // Move to the next node.
+    struct _cl_lru_node *node = list->sentinel.next;
+    while (node != &list->sentinel) {
+        struct _cl_lru_node *next = node->next;
+        free(node);
+        node = next;
+    }
+
+    node = list->spare;
+    while (node != NULL) {
+        struct _cl_lru_node *next = node->next;
+        free(node);
+        node = next;
     }
 
-    // Free the list structure itself.
+    free(list->buckets);
     free(list);
 }
 
 
 
-
 // Documented in .h file
-int CL_length(CList list)
+CListLRUHandle CL_lru_push(CListLRU list, CListElementType element)
 {
-  assert(list);
-#ifdef DEBUG
-  // In production code, we simply return the stored value for
-  // length. However, as a defensive programming method to prevent
-  // bugs in our code, in DEBUG mode we walk the list and ensure the
-  // number of elements on the list is equal to the stored length.
+    assert(list);
 
-  int len = 0;
-  for (struct _cl_node *node = list->head; node != NULL; node = node->next)
-    len++;
+    struct _cl_lru_node *node = list->spare;
+    if (node != NULL) {
+        list->spare = node->next;
+    } else {
+        node = malloc(sizeof(struct _cl_lru_node));
+        assert(node);
+    }
 
-  assert(len == list->length);
-#endif // DEBUG
+    // Grow before linking the node in, so that it is hashed only once
+    if (list->buckets != NULL) {
+        if ((size_t) list->length >= list->nbuckets)
+            _CL_lru_grow(list);
+        node->hash = _CL_hash(element);
+        size_t i = node->hash & (list->nbuckets - 1);
+        node->hash_next = list->buckets[i];
+        list->buckets[i] = node;
+    }
+
+    node->element = element;
+    node->prev = &list->sentinel;
+    node->next = list->sentinel.next;
+    node->next->prev = node;
+    list->sentinel.next = node;
+    list->length++;
 
-  return list->length;
+    return node;
 }
 
 
 
 // Documented in .h file
-void CL_print(CList list)
+CListElementType CL_lru_element(CListLRUHandle handle)
 {
-  assert(list);
+    assert(handle);
 
-  int num = 0;
-  for (struct _cl_node *node = list->head; node != NULL; node = node->next)
-    printf("  [%d]: %s\n", num++, node->element);
+    return handle->element;
 }
 
 
 
 // Documented in .h file
-void CL_push(CList list, CListElementType element)
+void CL_lru_touch(CListLRU list, CListLRUHandle handle)
 {
-  assert(list);
-  list->head = _CL_new_node(element, list->head);
-  list->length++;
+    assert(list);
+    assert(handle);
+
+    if (list->sentinel.next == handle)
+        return;
+
+    handle->prev->next = handle->next;
+    handle->next->prev = handle->prev;
+
+    handle->prev = &list->sentinel;
+    handle->next = list->sentinel.next;
+    handle->next->prev = handle;
+    list->sentinel.next = handle;
 }
 
 
 
 // Documented in .h file
-CListElementType CL_pop(CList list)
+CListElementType CL_lru_evict_tail(CListLRU list)
 {
-  assert(list);
+    assert(list);
 
-  struct _cl_node *popped_node = list->head;
+    if (list->length == 0)
+        return INVALID_RETURN;
 
-  if (popped_node == NULL)
-    return INVALID_RETURN;
+    return _CL_lru_unlink(list, list->sentinel.prev);
+}
 
-  CListElementType ret = popped_node->element;
 
-  // unlink previous head node, then free it
-  list->head = popped_node->next;
-  free(popped_node);
-  // we cannot refer to popped node any longer
 
-  list->length--;
+// Documented in .h file
+CListElementType CL_lru_remove(CListLRU list, CListLRUHandle handle)
+{
+    assert(list);
+    assert(handle);
 
-  return ret;
+    return _CL_lru_unlink(list, handle);
 }
 
 
 
 // Documented in .h file
-void CL_append(CList list, CListElementType element)
+CListLRUHandle CL_lru_find(CListLRU list, CListElementType element)
 {
-    assert(list);  // Ensure the list is valid
-
-    struct _cl_node *new_node = _CL_new_node(element, NULL);
-    assert(new_node);
+    assert(list);
+    assert(list->buckets);
 
-    if (list->head == NULL) {
-        // If the list is empty, the new node is the head.
-        list->head = new_node;
-    } else {
-        // Traverse to the end of the list and insert the new node.
-        struct _cl_node *current = list->head;
-        while (current->next != NULL) {
-            current = current->next;
-        }
-        current->next = new_node;
-    }
+    uint64_t hash = _CL_hash(element);
+    struct _cl_lru_node *node = list->buckets[hash & (list->nbuckets - 1)];
+    while (node != NULL && (node->hash != hash || strcmp(node->element, element) != 0))
+        node = node->hash_next;
 
-    // Increment the length of the list.
-    list->length++;
+    return node;
 }
+
+
+
 // Documented in .h file
-CListElementType CL_nth(CList list, int pos)
+int CL_lru_length(CListLRU list)
 {
     assert(list);
 
-    // If position is out of range, return INVALID_RETURN.
-    if (pos < -list->length || pos >= list->length)
-        return INVALID_RETURN;
+    return list->length;
+}
 
-    // Convert negative position to positive equivalent.
-    if (pos < 0)
-        pos = list->length + pos;
 
-    struct _cl_node *current = list->head;
-    for (int i = 0; i < pos; i++) {
-        current = current->next;
-    }
 
-    return current->element;
-}
 // Documented in .h file
-bool CL_insert(CList list, CListElementType element, int pos)
+CList CL_lru_to_list(CListLRU list)
 {
     assert(list);
 
-    // Check if position is out of bounds
-    if (pos < -list->length - 1 || pos > list->length)
-        return false;
+    CList result = CL_new();
+    struct _cl_node **tail = &result->head;
 
-    // Convert negative position to positive equivalent.
-    if (pos < 0)
-        pos = list->length + pos + 1;
+    for (struct _cl_lru_node *node = list->sentinel.next; node != &list->sentinel;
+         node = node->next) {
+        *tail = _CL_new_node(result, node->element, NULL);
+        tail = &(*tail)->next;
+        result->length++;
+    }
+    _CL_STAT_PEAK(result);
 
-    if (pos == 0) {
-        // Insert at the head.
-        CL_push(list, element);
-    } else {
-        struct _cl_node *current = list->head;
+    return result;
+}
 
-        // Traverse to the node before the position where we want to insert.
-        for (int i = 0; i < pos - 1; i++) {
-            current = current->next;
-        }
 
-        // Insert the new node.
-        struct _cl_node *new_node = _CL_new_node(element, current->next);
-        current->next = new_node;
 
-        list->length++;
-    }
+/*
+ * Views. A view records the node at the start of its range, so every
+ * walk starts there rather than at the head. Forward views keep a
+ * finger of their own, as lists do. Reversed views cannot be walked
+ * backwards through the singly linked chain, so CL_view_nth indexes
+ * them and CL_view_foreach replays them segment by segment.
+ */
+struct _cl_view {
+    struct _cl_node *first;             // node at from; NULL if empty
+    int64_t length;
+    bool reversed;
+
+    // Forward views: the last node found by CL_view_nth
+    struct _cl_node *finger_node;
+    int64_t finger_pos;
+
+    // Reversed views: the elements in forward order, once built
+    CListElementType *index;
+};
+
+
 
-    return true;
-}
 // Documented in .h file
-CListElementType CL_remove(CList list, int pos)
+CListView CL_view_new(CList list, int64_t from, int64_t to, bool reversed)
 {
     assert(list);
+    _CL_settle(list);
 
-    // Check if position is out of bounds
-    if (pos < -list->length || pos >= list->length)
-        return INVALID_RETURN;
+    if (from < 0 || from > to || to > _CL_READ(list->length))
+        return NULL;
 
-    // Convert negative position to positive equivalent.
-    if (pos < 0)
-        pos = list->length + pos;
+    CListView view = malloc(sizeof(struct _cl_view));
+    assert(view);
 
-    struct _cl_node *current = list->head;
-    CListElementType removed_element;
+    struct _cl_node *node = _CL_READ(list->head);
+    for (int64_t i = 0; i < from; i++)
+        node = _CL_READ(node->next);
 
-    if (pos == 0) {
-        // Remove the head element.
-        removed_element = CL_pop(list);
-    } else {
-        // Traverse to the node before the one we want to remove.
-        for (int i = 0; i < pos - 1; i++) {
-            current = current->next;
-        }
+    view->first = (from < to) ? node : NULL;
+    view->length = to - from;
+    view->reversed = reversed;
+    view->finger_node = NULL;
+    view->finger_pos = 0;
+    view->index = NULL;
+
+    return view;
+}
 
-        struct _cl_node *node_to_remove = current->next;
-        removed_element = node_to_remove->element;
-        current->next = node_to_remove->next;
 
-        free(node_to_remove);
-        list->length--;
-    }
 
-    return removed_element;
-}
 // Documented in .h file
-CList CL_copy(CList src_list)
+void CL_view_free(CListView view)
 {
-    assert(src_list);
+    if (view == NULL)
+        return;
 
-    CList new_list = CL_new();
+    free(view->index);
+    free(view);
+}
 
-    struct _cl_node *current = src_list->head;
 
-    // Traverse the source list and append each element to the new list.
-    while (current != NULL) {
-        CL_append(new_list, current->element);
-        current = current->next;
-    }
 
-    return new_list;
+// Documented in .h file
+int64_t CL_view_length(CListView view)
+{
+    assert(view);
+
+    return view->length;
 }
+
+
+
 // Documented in .h file
-int CL_insert_sorted(CList list, CListElementType element)
+CListElementType CL_view_nth(CListView view, int64_t pos)
 {
-    assert(list);
+    assert(view);
 
-    struct _cl_node *current = list->head;
-    int pos = 0;
+    if (pos < -view->length || pos >= view->length)
+        return INVALID_RETURN;
 
-    // Traverse until we find the appropriate position.
-    while (current != NULL && strcmp(element, current->element) > 0) {
-        current = current->next;
-        pos++;
+    if (pos < 0)
+        pos = view->length + pos;
+
+    if (view->reversed) {
+        if (view->index == NULL) {
+            view->index = malloc(view->length * sizeof(CListElementType));
+            assert(view->index);
+            struct _cl_node *node = view->first;
+            for (int64_t i = 0; i < view->length; i++) {
+                view->index[i] = node->element;
+                node = _CL_READ(node->next);
+            }
+        }
+
+        return view->index[view->length - 1 - pos];
+    }
+
+    struct _cl_node *node = view->first;
+    int64_t i = 0;
+    if (view->finger_node != NULL && view->finger_pos <= pos) {
+        node = view->finger_node;
+        i = view->finger_pos;
     }
+    for (; i < pos; i++)
+        node = _CL_READ(node->next);
 
-    // Insert the element at the correct position.
-    CL_insert(list, element, pos);
+    view->finger_node = node;
+    view->finger_pos = pos;
 
-    return pos;
+    return node->element;
 }
 
 
+
 // Documented in .h file
-void CL_join(CList list1, CList list2)
+void CL_view_foreach(CListView view, CL_foreach64_callback callback, void *cb_data)
 {
-    assert(list1);
-    assert(list2);
+    assert(view);
+    assert(callback);
 
-    if (list2->head == NULL)
-        return;  // list2 is empty, nothing to do.
+    struct _cl_node *node = view->first;
 
-    if (list1->head == NULL) {
-        // If list1 is empty, just set list1->head to list2->head.
-        list1->head = list2->head;
-    } else {
-        // Traverse to the end of list1.
-        struct _cl_node *current = list1->head;
-        while (current->next != NULL) {
-            current = current->next;
+    if (!view->reversed) {
+        for (int64_t pos = 0; pos < view->length; pos++) {
+            callback(pos, node->element, cb_data);
+            node = _CL_READ(node->next);
         }
+        return;
+    }
 
-        // Link list2 at the end of list1.
-        current->next = list2->head;
+    if (view->length == 0)
+        return;
+
+    // Remember the first node of each segment on one pass, then fill a
+    // segment's elements from its first node and hand them out
+    // backwards, last segment first
+    int64_t seg = 64;
+    while (seg * seg < view->length)
+        seg *= 2;
+    int64_t nsegs = (view->length + seg - 1) / seg;
+    struct _cl_node **starts = malloc(nsegs * sizeof(struct _cl_node *));
+    CListElementType *buffer = malloc(seg * sizeof(CListElementType));
+    assert(starts && buffer);
+
+    for (int64_t i = 0; i < view->length; i++) {
+        if (i % seg == 0)
+            starts[i / seg] = node;
+        node = _CL_READ(node->next);
+    }
+
+    int64_t pos = 0;
+    for (int64_t s = nsegs - 1; s >= 0; s--) {
+        int64_t n = (s == nsegs - 1) ? view->length - s * seg : seg;
+        node = starts[s];
+        for (int64_t i = 0; i < n; i++) {
+            buffer[i] = node->element;
+            node = _CL_READ(node->next);
+        }
+        while (n > 0)
+            callback(pos++, buffer[--n], cb_data);
     }
 
-    // Update length of list1 and set list2 to empty.
-    list1->length += list2->length;
-    list2->head = NULL;
-    list2->length = 0;
+    free(starts);
+    free(buffer);
 }
 
 
+
 // Documented in .h file
-void CL_reverse(CList list)
+CList CL_view_to_list(CListView view)
 {
-    assert(list);
-
-    struct _cl_node *prev = NULL, *current = list->head, *next = NULL;
-
-    while (current != NULL) {
-        next = current->next;  // Store reference to next node.
-        current->next = prev;  // Reverse the link.
-        prev = current;        // Move `prev` to current node.
-        current = next;        // Move `current` to next node.
+    assert(view);
+
+    CList result = CL_new();
+    struct _cl_node **tail = &result->head;
+    struct _cl_node *node = view->first;
+
+    // Pushing each element reverses the range; appending keeps it
+    for (int64_t i = 0; i < view->length; i++) {
+        if (view->reversed) {
+            result->head = _CL_new_node(result, node->element, result->head);
+        } else {
+            *tail = _CL_new_node(result, node->element, NULL);
+            tail = &(*tail)->next;
+        }
+        node = _CL_READ(node->next);
     }
+    result->length = view->length;
+    _CL_STAT_PEAK(result);
 
-    list->head = prev;  // Update the head of the list.
+    return result;
 }
 
 
 
 // Documented in .h file
-void CL_foreach(CList list, CL_foreach_callback callback, void *cb_data)
+void CL_stats(CList list, CListStats *stats)
 {
-    assert(list);
-    assert(callback);
-
-    struct _cl_node *current = list->head;
-    int pos = 0;
+    assert(stats);
 
-    while (current != NULL) {
-        callback(pos, current->element, cb_data);
-        current = current->next;
-        pos++;
+#ifdef CL_STATS
+    if (list != NULL) {
+        *stats = list->stats;
+    } else {
+        // Snapshot the totals one counter at a time.
+#define LOAD(field) \
+        stats->field = __atomic_load_n(&_CL_global_stats.field, __ATOMIC_RELAXED)
+        LOAD(allocs); LOAD(inline_allocs); LOAD(frees);
+        LOAD(nth_calls); LOAD(nth_walked);
+        LOAD(insert_calls); LOAD(insert_walked);
+        LOAD(remove_calls); LOAD(remove_walked);
+        LOAD(append_calls); LOAD(append_slow); LOAD(append_walked);
+        LOAD(peak_length);
+#undef LOAD
     }
-}
\ No newline at end of file
+#else
+    (void) list;
+    memset(stats, 0, sizeof(*stats));
+#endif // CL_STATS
+}
+
+
+
+// Documented in .h file
+void CL_stats_dump(CList list, FILE *fp)
+{
+    assert(fp);
+
+    CListStats st;
+    CL_stats(list, &st);
+
+#ifndef CL_STATS
+    fprintf(fp, "CList stats: not available (build clist.c with -DCL_STATS)\n");
+#else
+    // Average nodes walked per call; a value that grows with the list
+    // length means the caller is doing O(n^2) work.
+#define AVG(walked, calls) ((calls) ? (double) (walked) / (calls) : 0.0)
+
+    fprintf(fp, "CList stats for %s:\n", list ? "list" : "all lists");
+    fprintf(fp, "  nodes allocated  %llu (%llu inline)\n", st.allocs, st.inline_allocs);
+    fprintf(fp, "  nodes freed      %llu\n", st.frees);
+    fprintf(fp, "  peak length      %lld\n", st.peak_length);
+    fprintf(fp, "  CL_nth           %llu calls, %llu walked, %.1f/call\n",
+            st.nth_calls, st.nth_walked, AVG(st.nth_walked, st.nth_calls));
+    fprintf(fp, "  CL_insert        %llu calls, %llu walked, %.1f/call\n",
+            st.insert_calls, st.insert_walked, AVG(st.insert_walked, st.insert_calls));
+    fprintf(fp, "  CL_remove        %llu calls, %llu walked, %.1f/call\n",
+            st.remove_calls, st.remove_walked, AVG(st.remove_walked, st.remove_calls));
+    fprintf(fp, "  CL_append        %llu calls, %llu slow, %.1f walked/call\n",
+            st.append_calls, st.append_slow, AVG(st.append_walked, st.append_calls));
+
+#undef AVG
+#endif // CL_STATS
+}
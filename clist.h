@@ -10,6 +10,10 @@
 #define _CLIST_H_
 
 #include <stdbool.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
 
 // struct _clist is defined in .c file
 typedef struct _clist *CList;
@@ -22,6 +26,39 @@ typedef const char * CListElementType;
 // Used to indicate an error on some functions
 #define INVALID_RETURN NULL
 
+// Returned by CL_insert_sorted and CL_insert_sorted64 where there is no
+// position to report. No list is long enough for either to be a valid
+// position, negative or not.
+#define CL_NO_POSITION    INT_MIN
+#define CL_NO_POSITION64  INT64_MIN
+
+// Number of nodes stored inside the list header itself. Lists no
+// longer than this never call malloc for their nodes.
+#define CL_INLINE_NODES 8
+
+// Caller-provided memory for a list header; see CL_init. The size
+// must be at least sizeof(struct _clist), which clist.c checks.
+#define CL_STORAGE_SIZE 512
+typedef union {
+  char bytes[CL_STORAGE_SIZE];
+  void *align_ptr;
+  long long align_ll;
+} CListStorage;
+
+// Memory allocator for list headers and nodes. free is passed the
+// same size that was given to alloc. Both receive ctx unchanged.
+typedef struct {
+  void *(*alloc)(size_t size, void *ctx);
+  void (*free)(void *ptr, size_t size, void *ctx);
+  void *ctx;
+} CListAllocator;
+
+// Built-in allocators. CL_malloc_allocator is the default.
+// CL_thread_cache_allocator keeps freed nodes on a per-thread free list
+// to avoid contending on malloc when many threads churn lists.
+extern const CListAllocator CL_malloc_allocator;
+extern const CListAllocator CL_thread_cache_allocator;
+
 /*
  * Create a new CList 
  *
@@ -33,7 +70,122 @@ CList CL_new();
 
 
 /*
- * Destroy a list, calling free() on all malloc'd memory.
+ * Create a new CList whose header and nodes come from allocator. The
+ * allocator must remain valid until the list has been freed.
+ *
+ * Parameters:
+ *   allocator  The allocator to use
+ * 
+ * Returns: The new list
+ */
+CList CL_new_with_allocator(const CListAllocator *allocator);
+
+
+/*
+ * Release the blocks cached by CL_thread_cache_allocator on the
+ * calling thread. This also happens automatically when a thread
+ * exits.
+ *
+ * Parameters: None
+ * 
+ * Returns: None
+ */
+void CL_thread_cache_flush(void);
+
+
+/*
+ * Create a new, empty CList in caller-provided storage, for instance
+ * a CListStorage on the stack. Together with the inline nodes, this
+ * makes short-lived small lists allocation-free.
+ *
+ * The list must still be destroyed with CL_free, which frees any
+ * nodes that did not fit inline but leaves storage itself alone. The
+ * list must not be used after storage goes out of scope.
+ *
+ * Parameters:
+ *   storage  Memory for the list header
+ * 
+ * Returns: The new list, which lives in storage
+ */
+CList CL_init(CListStorage *storage);
+
+
+/*
+ * Create a new CList for read-mostly concurrent use. Any number of
+ * threads may call CL_length, CL_nth, CL_foreach, CL_copy and
+ * CL_print without locking, provided they do so between
+ * CL_read_lock() and CL_read_unlock(), while one writer at a time
+ * calls CL_push, CL_pop, CL_append, CL_insert, CL_remove,
+ * CL_insert_sorted or CL_join (as list1). Removed nodes are freed only
+ * once no reader can still be traversing them.
+ *
+ * Writers must be serialized by the caller. CL_reverse, the sorts and
+ * CL_free must not run concurrently with readers. A reader's CL_nth
+ * returns INVALID_RETURN if the list shrinks below pos meanwhile.
+ *
+ * Parameters: None
+ * 
+ * Returns: The new list
+ */
+CList CL_new_read_mostly();
+
+
+/*
+ * Create a new CList for use as a priority queue. CL_insert_sorted
+ * adds to a heap in O(log n) instead of walking the list, and CL_pop
+ * removes the least element, by strcmp, in O(log n). Among equal
+ * elements, the order they are popped in is unspecified.
+ *
+ * Every other function may be used as well, and sees the list in
+ * sorted order: the first one called after a run of insertions merges
+ * them into the list, in O(k log k + n) for k insertions. CL_length is
+ * always O(1). Alternating insertions with other calls, such as
+ * CL_nth, therefore costs as much as an ordinary sorted list.
+ *
+ * Parameters: None
+ * 
+ * Returns: The new list
+ */
+CList CL_new_priority_queue();
+
+
+/*
+ * Enter a read-side section, within which nodes of read-mostly lists
+ * will not be freed. Sections may nest, and must be short: memory
+ * removed from any read-mostly list is held until every section that
+ * was active at the time has ended.
+ *
+ * Parameters: None
+ * 
+ * Returns: None
+ */
+void CL_read_lock(void);
+
+
+/*
+ * Leave a read-side section entered with CL_read_lock.
+ *
+ * Parameters: None
+ * 
+ * Returns: None
+ */
+void CL_read_unlock(void);
+
+
+/*
+ * Wait until every node removed from a read-mostly list so far has
+ * been freed. Must not be called from inside a read-side section.
+ *
+ * Parameters: None
+ * 
+ * Returns: None
+ */
+void CL_synchronize(void);
+
+
+/*
+ * Destroy a list, calling free() on all malloc'd memory. For a list
+ * created with CL_init, the caller's storage is not freed.
  *
  * Parameters:
  *   list   The list; if NULL, no action will occur
@@ -44,6 +196,49 @@ void CL_free(CList list);
 
 
 
+/*
+ * Destroy a list in the background. The list is handed to a reclaimer
+ * thread in O(1), which then frees it as CL_free would; the caller must
+ * not use the list again. A list created with CL_init is freed
+ * immediately instead, since its storage belongs to the caller, and so
+ * is a list with an allocator other than the built-in ones, which may
+ * not be safe to call from another thread.
+ *
+ * Parameters:
+ *   list   The list; if NULL, no action will occur
+ * 
+ * Returns: None
+ */
+void CL_free_deferred(CList list);
+
+
+/*
+ * Wait until every list passed to CL_free_deferred so far has been
+ * freed.
+ *
+ * Parameters: None
+ * 
+ * Returns: None
+ */
+void CL_free_deferred_wait(void);
+
+
+/*
+ * Destroy a list incrementally, freeing at most budget nodes per call,
+ * so that a large list can be released from an event loop without a
+ * long stall. Once destruction has started, the list may only be
+ * passed to CL_free_step again (or to CL_free, to finish at once).
+ *
+ * Parameters:
+ *   list     The list
+ *   budget   Maximum number of nodes to free in this call (> 0)
+ * 
+ * Returns: true once the list has been completely destroyed,
+ *   false if more calls are needed
+ */
+bool CL_free_step(CList list, int budget);
+
+
 /*
  * Compute the length of a list
  *
@@ -55,6 +250,14 @@ void CL_free(CList list);
 int CL_length(CList list);
 
 
+// The functions ending in 64 behave exactly as their counterparts
+// without the suffix, but take and return 64-bit positions, lengths
+// and counts, for lists of 2^31 or more elements. The int versions may
+// only be used while these fit in an int; in DEBUG builds they assert
+// that.
+int64_t CL_length64(CList list);
+
+
 /*
  * Print the list
  *
@@ -120,10 +323,24 @@ void CL_append(CList list, CListElementType element);
  * 
  * pos must be in the range [-length, length-1] inclusive. If pos is
  * outside this range, returns INVALID_RETURN.
+ *
+ * The list remembers the last position found by CL_insert or
+ * CL_remove, and each thread remembers the last position its CL_nth
+ * found on the list, until the list is next modified. A later call
+ * for the same or a higher position walks on from whichever is
+ * nearer, so visiting positions in increasing order is O(1) per call.
+ * (Read-mostly lists always walk from the head.)
+ *
+ * Since CL_nth writes nothing shared, any number of threads may call
+ * it at once, for instance under the read side of a reader-writer
+ * lock, provided none modifies the list meanwhile. The exception is
+ * a list made by CL_new_priority_queue, where CL_nth may first merge
+ * pending insertions into the list.
  * 
  * Returns: The requested element, or INVALID_RETURN if no element was found.
  */
 CListElementType CL_nth(CList list, int pos);
+CListElementType CL_nth64(CList list, int64_t pos);
 
 
 /*
@@ -150,6 +367,7 @@ CListElementType CL_nth(CList list, int pos);
  * Returns: true if the operation was successful, false otherwise
  */
 bool CL_insert(CList list, CListElementType element, int pos);
+bool CL_insert64(CList list, CListElementType element, int64_t pos);
 
 
 /*
@@ -175,6 +393,7 @@ bool CL_insert(CList list, CListElementType element, int pos);
  *   element was removed.
  */
 CListElementType CL_remove(CList list, int pos);
+CListElementType CL_remove64(CList list, int64_t pos);
 
 
 /*
@@ -192,6 +411,88 @@ CListElementType CL_remove(CList list, int pos);
 CList CL_copy(CList src_list);
 
 
+/*
+ * Build a list from the contents of a file, split on delimiter.
+ * The file is memory-mapped and the elements point straight into the
+ * mapping, which is private: the file itself is never modified. The
+ * mapping belongs to the list, and is unmapped by CL_free (or handed
+ * on to list1 if the list is passed as list2 to CL_join). Elements
+ * copied elsewhere, for instance by CL_copy, are only valid as long as
+ * the mapping is.
+ *
+ * A delimiter at the end of the file does not produce an empty final
+ * element, so a file of newline-terminated lines yields one element
+ * per line.
+ *
+ * Parameters:
+ *   path       The file to read
+ *   delimiter  The character separating elements, e.g. '\n'
+ * 
+ * Returns: The new list, or NULL if the file could not be read
+ */
+CList CL_from_file(const char *path, char delimiter);
+
+
+/*
+ * Copy the list as CL_copy does, splitting the work across up to
+ * nthreads threads. Small lists are copied serially.
+ *
+ * Parameters:
+ *   src_list  The list to copy
+ *   nthreads  Maximum number of threads to use
+ * 
+ * Returns:  A new list, which is a copy of the argument.
+ */
+CList CL_copy_parallel(CList src_list, int nthreads);
+
+
+/*
+ * Sort the list, following the rules for the strcmp function. The
+ * sort is stable and relinks the existing nodes, so it never
+ * allocates.
+ *
+ * Parameters:
+ *   list     The list
+ * 
+ * Returns: None
+ */
+void CL_sort(CList list);
+
+
+/*
+ * Merge two sorted lists in linear time. The nodes of src are linked
+ * into dst, following the rules for the strcmp function, without
+ * allocating. After this operation src will still exist, but it will
+ * be empty (length == 0), as with CL_join.
+ *
+ * Equal elements from src are placed before those from dst, which is
+ * where CL_insert_sorted would put them; otherwise the relative order
+ * of each list's elements is preserved. It is up to the caller to
+ * ensure that both lists are sorted.
+ *
+ * Parameters:
+ *   dst      The list to merge into, which will grow in size
+ *   src      The list to merge from, which will be emptied
+ * 
+ * Returns: None
+ */
+void CL_merge_sorted(CList dst, CList src);
+
+
+/*
+ * Sort the list as CL_sort does, splitting the work across up to
+ * nthreads threads. The result is identical to CL_sort. Small lists
+ * are sorted serially.
+ *
+ * Parameters:
+ *   list      The list
+ *   nthreads  Maximum number of threads to use
+ * 
+ * Returns: None
+ */
+void CL_sort_parallel(CList list, int nthreads);
+
+
 /*
  * Insert a new element into its proper position within a sorted
  * list. Note it is up to the caller to ensure that the list is sorted
@@ -203,15 +504,86 @@ CList CL_copy(CList src_list);
  *   list     The list
  *   element  The element to insert
  * 
- * Returns: The position the element was inserted into
+ * Returns: The position the element was inserted into, or
+ *   CL_NO_POSITION (CL_NO_POSITION64) for a list made by
+ *   CL_new_priority_queue, which does not track it
  */
 int CL_insert_sorted(CList list, CListElementType element);
+int64_t CL_insert_sorted64(CList list, CListElementType element);
+
+
+typedef bool (*CL_predicate)(CListElementType element, void *cb_data);
+
+/*
+ * Remove every element for which predicate returns true, in a single
+ * pass over the list. Each call to predicate will be of the form
+ *
+ *   predicate( <element>, <cb_data> )
+ *
+ * Parameters:
+ *   list       The list
+ *   predicate  The function to call
+ *   cb_data    Caller data to pass to the function
+ * 
+ * Returns: The number of elements removed
+ */
+int CL_remove_if(CList list, CL_predicate predicate, void *cb_data);
+int64_t CL_remove_if64(CList list, CL_predicate predicate, void *cb_data);
+
+
+/*
+ * Move every element for which predicate returns true to the end of
+ * out_list, in a single pass and keeping their order. Nodes are
+ * relinked rather than copied where possible, as with CL_join. For a
+ * list built with CL_from_file, the moved elements still point into
+ * list's mapping.
+ *
+ * Parameters:
+ *   list       The list to take elements from
+ *   predicate  The function to call, as for CL_remove_if
+ *   cb_data    Caller data to pass to the function
+ *   out_list   The list to move matching elements to
+ * 
+ * Returns: The number of elements moved
+ */
+int CL_partition(CList list, CL_predicate predicate, void *cb_data, CList out_list);
+int64_t CL_partition64(CList list, CL_predicate predicate, void *cb_data, CList out_list);
+
+
+/*
+ * Remove duplicate elements (as compared by strcmp) from the list,
+ * keeping the first occurrence of each. Runs in linear expected time,
+ * using a temporary hash table.
+ *
+ * Parameters:
+ *   list     The list
+ * 
+ * Returns: The number of elements removed
+ */
+int CL_dedup(CList list);
+int64_t CL_dedup64(CList list);
+
+
+/*
+ * Remove duplicate elements from a sorted list, keeping the first of
+ * each run of equal elements. This takes one pass and no extra
+ * memory. Note it is up to the caller to ensure that the list is
+ * sorted; otherwise only adjacent duplicates are removed.
+ *
+ * Parameters:
+ *   list     The list
+ * 
+ * Returns: The number of elements removed
+ */
+int CL_unique_sorted(CList list);
+int64_t CL_unique_sorted64(CList list);
 
 
 /*
  * Join (concatenate) two lists. The contents of list2 are appended
  * to list1. After this operation, list2 will still exist, but it will
- * be empty (length == 0).
+ * be empty (length == 0). Nodes are moved rather than copied, unless
+ * the two lists use different allocators.
  * 
  * Example: If list1 = A B C D and list2 = X Y Z, after CL_join
  * returns, list1 will contain A B C D X Y Z and list2 will be empty.
@@ -239,6 +611,7 @@ void CL_reverse(CList list);
 
 
 typedef void (*CL_foreach_callback)(int pos, CListElementType element, void *cb_data);
+typedef void (*CL_foreach64_callback)(int64_t pos, CListElementType element, void *cb_data);
 
 /*
  * Iterate through the list; call the user-specified callback function
@@ -254,6 +627,354 @@ typedef void (*CL_foreach_callback)(int pos, CListElementType element, void *cb_
  * Returns: None
  */
 void CL_foreach(CList list, CL_foreach_callback callback, void *cb_data);
+void CL_foreach64(CList list, CL_foreach64_callback callback, void *cb_data);
+
+
+
+// A sorted list which many threads may update at once without locks.
+// Ordering follows strcmp, as for CL_insert_sorted.
+typedef struct _cl_concurrent *CListConcurrent;
+
+/*
+ * Create a new, empty concurrent sorted list
+ *
+ * Parameters: None
+ * 
+ * Returns: The new list
+ */
+CListConcurrent CL_concurrent_new();
+
+
+/*
+ * Destroy a concurrent sorted list. No other thread may be using it.
+ * Nodes removed earlier may be freed later, as for read-mostly lists;
+ * see CL_synchronize.
+ *
+ * Parameters:
+ *   list   The list; if NULL, no action will occur
+ * 
+ * Returns: None
+ */
+void CL_concurrent_free(CListConcurrent list);
+
+
+/*
+ * Insert an element before the first element that is not less than
+ * it, exactly as CL_insert_sorted would. Safe to call from any number
+ * of threads at once.
+ *
+ * Parameters:
+ *   list     The list
+ *   element  The element to insert
+ * 
+ * Returns: None
+ */
+void CL_concurrent_insert_sorted(CListConcurrent list, CListElementType element);
+
+
+/*
+ * Remove the first element which compares equal to element. Safe to
+ * call from any number of threads at once.
+ *
+ * Parameters:
+ *   list     The list
+ *   element  The value to remove
+ * 
+ * Returns: true if an element was removed, false if none was found
+ */
+bool CL_concurrent_remove(CListConcurrent list, CListElementType element);
+
+
+/*
+ * Check whether an element equal to element is on the list. Safe to
+ * call from any number of threads at once.
+ *
+ * Parameters:
+ *   list     The list
+ *   element  The value to look for
+ * 
+ * Returns: true if found, false otherwise
+ */
+bool CL_concurrent_contains(CListConcurrent list, CListElementType element);
+
+
+/*
+ * Return the number of elements on a concurrent sorted list. While
+ * other threads are updating it, this is only a snapshot.
+ *
+ * Parameters:
+ *   list     The list
+ * 
+ * Returns: The length of the list
+ */
+int CL_concurrent_length(CListConcurrent list);
+
+
+/*
+ * Copy the contents of a concurrent sorted list into a new CList,
+ * which must be destroyed by the caller.
+ *
+ * Parameters:
+ *   list     The list
+ * 
+ * Returns: A new list holding the same elements, in order
+ */
+CList CL_concurrent_to_list(CListConcurrent list);
+
+
+// A recency list for caches. Elements are kept from most to least
+// recently used; each is reached through a handle that stays valid
+// until the element is evicted or removed, so moving it to the front
+// takes no walk. Nodes given up by eviction are reused by later
+// pushes, so a full cache that evicts one element per push does not
+// allocate.
+typedef struct _cl_lru *CListLRU;
+typedef struct _cl_lru_node *CListLRUHandle;
+
+/*
+ * Create a new, empty recency list
+ *
+ * Parameters:
+ *   indexed  If true, keep a hash table from element to handle so that
+ *            CL_lru_find can be used
+ * 
+ * Returns: The new list
+ */
+CListLRU CL_lru_new(bool indexed);
+
+
+/*
+ * Destroy a recency list. All of its handles become invalid.
+ *
+ * Parameters:
+ *   list     The list; if NULL, no action will occur
+ * 
+ * Returns: None
+ */
+void CL_lru_free(CListLRU list);
+
+
+/*
+ * Add an element as the most recently used
+ *
+ * Parameters:
+ *   list     The list
+ *   element  The element to add
+ * 
+ * Returns: A handle to the element
+ */
+CListLRUHandle CL_lru_push(CListLRU list, CListElementType element);
+
+
+/*
+ * Return the element a handle refers to
+ *
+ * Parameters:
+ *   handle   A valid handle
+ * 
+ * Returns: The element
+ */
+CListElementType CL_lru_element(CListLRUHandle handle);
+
+
+/*
+ * Mark an element as the most recently used, in O(1)
+ *
+ * Parameters:
+ *   list     The list
+ *   handle   A valid handle on list
+ * 
+ * Returns: None
+ */
+void CL_lru_touch(CListLRU list, CListLRUHandle handle);
+
+
+/*
+ * Remove the least recently used element, in O(1). Its handle becomes
+ * invalid.
+ *
+ * Parameters:
+ *   list     The list
+ * 
+ * Returns: The element removed, or INVALID_RETURN if the list is empty
+ */
+CListElementType CL_lru_evict_tail(CListLRU list);
+
+
+/*
+ * Remove an element wherever it is, in O(1). The handle becomes
+ * invalid.
+ *
+ * Parameters:
+ *   list     The list
+ *   handle   A valid handle on list
+ * 
+ * Returns: The element removed
+ */
+CListElementType CL_lru_remove(CListLRU list, CListLRUHandle handle);
+
+
+/*
+ * Find an element by value, using the list's hash table. If several
+ * elements compare equal, the most recently pushed one is found.
+ *
+ * Parameters:
+ *   list     The list, which must have been created indexed
+ *   element  The value to look for
+ * 
+ * Returns: A handle to the element, or NULL if none was found
+ */
+CListLRUHandle CL_lru_find(CListLRU list, CListElementType element);
+
+
+/*
+ * Return the number of elements on a recency list
+ *
+ * Parameters:
+ *   list     The list
+ * 
+ * Returns: The length of the list
+ */
+int CL_lru_length(CListLRU list);
+
+
+/*
+ * Copy the contents of a recency list into a new CList, which must be
+ * destroyed by the caller
+ *
+ * Parameters:
+ *   list     The list
+ * 
+ * Returns: A new list holding the same elements, most recently used
+ *   first
+ */
+CList CL_lru_to_list(CListLRU list);
+
+
+// A read-only window onto part of a CList, optionally in reverse,
+// which neither copies nor changes the list. A view is valid until
+// its list is next modified, and must then be freed.
+typedef struct _cl_view *CListView;
+
+/*
+ * Create a view of positions [from, to) of a list. This takes O(1)
+ * memory and O(from) time.
+ *
+ * Parameters:
+ *   list      The list
+ *   from      The first position in the view, 0 <= from <= to
+ *   to        One past the last position, to <= the list's length
+ *   reversed  If true, the view presents the range last element first
+ * 
+ * Returns: The new view, or NULL if the range is invalid
+ */
+CListView CL_view_new(CList list, int64_t from, int64_t to, bool reversed);
+
+
+/*
+ * Destroy a view. The list it looks at is unaffected.
+ *
+ * Parameters:
+ *   view     The view; if NULL, no action will occur
+ * 
+ * Returns: None
+ */
+void CL_view_free(CListView view);
+
+
+/*
+ * Return the number of elements in a view
+ *
+ * Parameters:
+ *   view     The view
+ * 
+ * Returns: to - from, as given to CL_view_new
+ */
+int64_t CL_view_length(CListView view);
+
+
+/*
+ * Return the element at a position in a view, counting in the view's
+ * direction; negative positions count from the view's end, as for
+ * CL_nth. On a forward view, each call resumes from the previous
+ * position if it can, so reading positions in increasing order is
+ * O(1) per call. The first call on a reversed view builds an index of
+ * the view's elements, which is kept until CL_view_free.
+ *
+ * Parameters:
+ *   view     The view
+ *   pos      The position
+ * 
+ * Returns: The element, or INVALID_RETURN if pos is out of range
+ */
+CListElementType CL_view_nth(CListView view, int64_t pos);
+
+
+/*
+ * Call callback on each element of a view, in the view's order, with
+ * positions counted from 0 in that order. A reversed view is walked
+ * in segments of about sqrt(n) elements, using O(sqrt(n)) temporary
+ * memory and two passes over the range.
+ *
+ * Parameters:
+ *   view     The view
+ *   callback The function to call
+ *   cb_data  Passed to callback unchanged
+ * 
+ * Returns: None
+ */
+void CL_view_foreach(CListView view, CL_foreach64_callback callback, void *cb_data);
+
+
+/*
+ * Copy the elements of a view into a new CList, in the view's order,
+ * which must be destroyed by the caller
+ *
+ * Parameters:
+ *   view     The view
+ * 
+ * Returns: The new list
+ */
+CList CL_view_to_list(CListView view);
+
+
+// Operation counters, collected only when clist.c is compiled with
+// -DCL_STATS. Walk counts are the number of nodes stepped over, so
+// walked / calls is the average cost of one call.
+typedef struct {
+  unsigned long long allocs;          // nodes allocated
+  unsigned long long inline_allocs;   // ... of which came from the inline buffer
+  unsigned long long frees;           // nodes freed
+  unsigned long long nth_calls, nth_walked;
+  unsigned long long insert_calls, insert_walked;
+  unsigned long long remove_calls, remove_walked;
+  unsigned long long append_calls, append_slow, append_walked;
+  long long peak_length;              // longest length seen
+} CListStats;
+
+/*
+ * Retrieve operation counters. If clist.c was built without CL_STATS,
+ * all counters are zero.
+ *
+ * Parameters:
+ *   list     The list, or NULL for the totals over all lists
+ *   stats    Filled in with the counters
+ * 
+ * Returns: None
+ */
+void CL_stats(CList list, CListStats *stats);
+
+
+/*
+ * Print the counters from CL_stats in human-readable form
+ *
+ * Parameters:
+ *   list     The list, or NULL for the totals over all lists
+ *   fp       Where to print
+ * 
+ * Returns: None
+ */
+void CL_stats_dump(CList list, FILE *fp);
 
 
 
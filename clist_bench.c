@@ -0,0 +1,949 @@
+/*
+ * clist_bench.c
+ * 
+ * Benchmarks for CLists. Run with no arguments for all benchmarks, or
+ * name the benchmarks to run on the command line.
+ */
+
+#define _GNU_SOURCE   // for pthread_rwlockattr_setkind_np
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "clist.h"
+#include "clist_compact.h"
+#include "clist_external.h"
+#include "clist_journal.h"
+
+
+// Returns the current time in seconds, from a monotonic clock
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/*
+ * Allocator churn: each thread repeatedly builds a list, drains it and
+ * frees it.
+ */
+#define CHURN_ROUNDS  20000
+#define CHURN_LENGTH  64
+
+static void *churn_thread(void *arg)
+{
+  const CListAllocator *allocator = arg;
+
+  for (int round = 0; round < CHURN_ROUNDS; round++) {
+    CList list = CL_new_with_allocator(allocator);
+    for (int i = 0; i < CHURN_LENGTH; i++)
+      CL_push(list, "churn");
+    while (CL_pop(list) != INVALID_RETURN)
+      ;
+    CL_free(list);
+  }
+
+  CL_thread_cache_flush();
+  return NULL;
+}
+
+static void bench_allocator()
+{
+  const struct { const char *name; const CListAllocator *allocator; } modes[] = {
+    { "malloc", &CL_malloc_allocator },
+    { "thread-cache", &CL_thread_cache_allocator },
+  };
+  const int thread_counts[] = { 1, 2, 4, 8 };
+
+  printf("allocator churn (%d rounds x %d nodes per thread)\n",
+         CHURN_ROUNDS, CHURN_LENGTH);
+
+  for (int m = 0; m < 2; m++) {
+    for (int t = 0; t < 4; t++) {
+      int nthreads = thread_counts[t];
+      pthread_t threads[8];
+
+      double start = now();
+      for (int i = 0; i < nthreads; i++)
+        pthread_create(&threads[i], NULL, churn_thread, (void *) modes[m].allocator);
+      for (int i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+      double elapsed = now() - start;
+
+      double ops = (double) nthreads * CHURN_ROUNDS * CHURN_LENGTH * 2;
+      printf("  %-12s %d threads: %8.2f Mops/s\n", modes[m].name, nthreads,
+             ops / elapsed / 1e6);
+    }
+  }
+}
+
+
+/*
+ * Serial vs parallel sort and copy of a large list of random keys
+ */
+#define SORT_LENGTH 1000000
+
+static void bench_sort()
+{
+  char (*keys)[16] = malloc(SORT_LENGTH * sizeof(*keys));
+  CList list = CL_new();
+
+  srand(29);
+  for (int i = 0; i < SORT_LENGTH; i++) {
+    snprintf(keys[i], sizeof(keys[i]), "%08x", rand());
+    CL_push(list, keys[i]);
+  }
+
+  printf("sort and copy (%d nodes)\n", SORT_LENGTH);
+
+  const int thread_counts[] = { 1, 2, 4, 8 };
+  for (int t = 0; t < 4; t++) {
+    double start = now();
+    CList copy = CL_copy_parallel(list, thread_counts[t]);
+    double copied = now();
+    CL_sort_parallel(copy, thread_counts[t]);
+    double sorted = now();
+
+    printf("  %d threads: copy %7.1f ms, sort %7.1f ms\n", thread_counts[t],
+           (copied - start) * 1e3, (sorted - copied) * 1e3);
+    CL_free(copy);
+  }
+
+  CL_free(list);
+  free(keys);
+}
+
+
+/*
+ * Read scaling: reader threads repeatedly look up elements while one
+ * writer inserts and removes, first with a reader-writer lock around a
+ * plain list, then lock-free on a read-mostly list.
+ */
+#define SCALING_LENGTH   1000
+#define SCALING_SECONDS  0.2
+
+struct scaling_state {
+  CList list;
+  pthread_rwlock_t lock;
+  bool read_mostly;
+  int stop;
+};
+
+static void *scaling_reader(void *arg)
+{
+  struct scaling_state *st = arg;
+  long lookups = 0;
+
+  // Positions descend, so a lookup never resumes from this thread's
+  // previous one
+  while (!__atomic_load_n(&st->stop, __ATOMIC_RELAXED)) {
+    int pos = SCALING_LENGTH / 2 - 1 - lookups % (SCALING_LENGTH / 2);
+    if (st->read_mostly) {
+      CL_read_lock();
+      CL_nth(st->list, pos);
+      CL_read_unlock();
+    } else {
+      pthread_rwlock_rdlock(&st->lock);
+      CL_nth(st->list, pos);
+      pthread_rwlock_unlock(&st->lock);
+    }
+    lookups++;
+  }
+
+  return (void *) lookups;
+}
+
+static void *scaling_writer(void *arg)
+{
+  struct scaling_state *st = arg;
+  long writes = 0;
+
+  while (!__atomic_load_n(&st->stop, __ATOMIC_RELAXED)) {
+    int pos = writes % SCALING_LENGTH;
+    if (!st->read_mostly)
+      pthread_rwlock_wrlock(&st->lock);
+    CL_insert(st->list, "writer", pos);
+    CL_remove(st->list, pos);
+    if (!st->read_mostly)
+      pthread_rwlock_unlock(&st->lock);
+    writes++;
+  }
+
+  return (void *) writes;
+}
+
+static void bench_read_scaling()
+{
+  const int thread_counts[] = { 1, 2, 4, 8, 16, 32, 64 };
+  pthread_t threads[64], writer;
+
+  printf("read scaling (%d-node list, CL_nth, one writer, %.1fs per run)\n",
+         SCALING_LENGTH, SCALING_SECONDS);
+
+  // Prefer the writer, as a reader-preferring lock can starve it forever
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+
+  for (int mode = 0; mode < 2; mode++) {
+    for (int t = 0; t < 7; t++) {
+      struct scaling_state st;
+      st.read_mostly = (mode == 1);
+      st.list = st.read_mostly ? CL_new_read_mostly() : CL_new();
+      st.stop = 0;
+      pthread_rwlock_init(&st.lock, &attr);
+      for (int i = 0; i < SCALING_LENGTH; i++)
+        CL_push(st.list, "scaling");
+
+      double start = now();
+      for (int i = 0; i < thread_counts[t]; i++)
+        pthread_create(&threads[i], NULL, scaling_reader, &st);
+      pthread_create(&writer, NULL, scaling_writer, &st);
+
+      struct timespec run = { 0, SCALING_SECONDS * 1e9 };
+      nanosleep(&run, NULL);
+      __atomic_store_n(&st.stop, 1, __ATOMIC_RELAXED);
+
+      long lookups = 0;
+      void *n;
+      for (int i = 0; i < thread_counts[t]; i++) {
+        pthread_join(threads[i], &n);
+        lookups += (long) n;
+      }
+      pthread_join(writer, &n);
+      long writes = (long) n;
+      double elapsed = now() - start;
+
+      printf("  %-11s %2d readers: %8.2f M lookups/s, %8.2f K writes/s\n",
+             st.read_mostly ? "read-mostly" : "rwlock", thread_counts[t],
+             lookups / elapsed / 1e6, writes / elapsed / 1e3);
+
+      CL_free(st.list);
+      CL_synchronize();
+      pthread_rwlock_destroy(&st.lock);
+    }
+  }
+
+  pthread_rwlockattr_destroy(&attr);
+}
+
+
+/*
+ * Memory and traversal cost of a CList against a CListCompact
+ */
+#define COMPACT_LENGTH 10000000
+
+// Returns the resident set size, in bytes
+static size_t rss()
+{
+  long size, pages = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (fp != NULL) {
+    if (fscanf(fp, "%ld %ld", &size, &pages) != 2)
+      pages = 0;
+    fclose(fp);
+  }
+  return pages * 4096;
+}
+
+static void count_cb(int pos, CListElementType element, void *cb_data)
+{
+  *(long *) cb_data += element[0];
+}
+
+static void compact_count_cb(int64_t pos, CListElementType element, void *cb_data)
+{
+  *(long *) cb_data += element[0];
+}
+
+static void bench_compact()
+{
+  static const char *words[] = { "alpha", "bravo", "charlie", "delta" };
+  long sum = 0;
+
+  printf("compact storage (%d nodes, 4 distinct strings)\n", COMPACT_LENGTH);
+
+  // The compact list goes first: both take their memory from malloc,
+  // and the second would otherwise reuse what the first freed
+  size_t before = rss();
+  CListCompact compact = CL_compact_new();
+  for (int i = 0; i < COMPACT_LENGTH; i++)
+    CL_compact_push(compact, words[i / 1000 % 4]);
+  size_t compact_rss = rss() - before;
+
+  double start = now();
+  CL_compact_foreach(compact, compact_count_cb, &sum);
+  double compact_time = now() - start;
+  CL_compact_free(compact);
+
+  before = rss();
+  CList list = CL_new();
+  for (int i = 0; i < COMPACT_LENGTH; i++)
+    CL_push(list, words[i / 1000 % 4]);
+  size_t list_rss = rss() - before;
+
+  start = now();
+  CL_foreach(list, count_cb, &sum);
+  double list_time = now() - start;
+  CL_free(list);
+
+  printf("  CList         %6.1f MB RSS (%5.1f bytes/node), foreach %6.1f ms\n",
+         list_rss / 1e6, (double) list_rss / COMPACT_LENGTH, list_time * 1e3);
+  printf("  CListCompact  %6.1f MB RSS (%5.1f bytes/node), foreach %6.1f ms\n",
+         compact_rss / 1e6, (double) compact_rss / COMPACT_LENGTH, compact_time * 1e3);
+  if (sum == 42)
+    printf("\n");   // keep sum alive
+}
+
+
+/*
+ * Free latency: an event loop that periodically releases a large list.
+ * Each call into the library is timed; a CL_free of the whole list is
+ * one long stall, while CL_free_deferred and CL_free_step keep every
+ * call short. CL_free_deferred only hides the cost when the reclaimer
+ * has a CPU of its own; on one CPU it preempts the loop instead.
+ */
+#define FREE_LISTS   20
+#define FREE_LENGTH  1000000
+#define FREE_BUDGET  1000
+
+static int compare_doubles(const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static CList free_latency_list()
+{
+  CList list = CL_new();
+  for (int i = 0; i < FREE_LENGTH; i++)
+    CL_push(list, "x");
+  return list;
+}
+
+static void report_stalls(const char *mode, double *stalls, int n)
+{
+  qsort(stalls, n, sizeof(double), compare_doubles);
+  printf("  %-18s %7d calls  p50 %9.1f us  p99 %9.1f us  max %9.1f us\n",
+         mode, n, stalls[n / 2] * 1e6, stalls[n * 99 / 100] * 1e6, stalls[n - 1] * 1e6);
+}
+
+static void bench_free_latency()
+{
+  int max_stalls = FREE_LISTS * (FREE_LENGTH / FREE_BUDGET + 1);
+  double *stalls = malloc(max_stalls * sizeof(double));
+  int n;
+
+  printf("free latency (%d lists of %d nodes)\n", FREE_LISTS, FREE_LENGTH);
+
+  n = 0;
+  for (int i = 0; i < FREE_LISTS; i++) {
+    CList list = free_latency_list();
+    double start = now();
+    CL_free(list);
+    stalls[n++] = now() - start;
+  }
+  report_stalls("CL_free", stalls, n);
+
+  n = 0;
+  for (int i = 0; i < FREE_LISTS; i++) {
+    CList list = free_latency_list();
+    double start = now();
+    CL_free_deferred(list);
+    stalls[n++] = now() - start;
+  }
+  CL_free_deferred_wait();
+  report_stalls("CL_free_deferred", stalls, n);
+
+  n = 0;
+  for (int i = 0; i < FREE_LISTS; i++) {
+    CList list = free_latency_list();
+    bool done = false;
+    while (!done) {
+      double start = now();
+      done = CL_free_step(list, FREE_BUDGET);
+      stalls[n++] = now() - start;
+    }
+  }
+  report_stalls("CL_free_step", stalls, n);
+
+  free(stalls);
+}
+
+
+/*
+ * Hardware counters: each operation is wrapped in a set of
+ * perf_event_open counters and reported per element. Counters the
+ * kernel or CPU will not provide (in a container, a VM, or with
+ * kernel.perf_event_paranoid > 2) are shown as "n/a", and the wall
+ * time is always reported.
+ */
+#define COUNTER_LENGTH  1000000
+#define COUNTER_SMALL   10000   // for operations that are O(n) per element
+
+#define CACHE_MISS(cache) \
+  ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+} counter_events[] = {
+  { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instrs", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "L1d-miss", PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D) },
+  { "LLC-miss", PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_LL) },
+  { "br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  { "dTLB-miss", PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+};
+
+#define NUM_COUNTERS ((int) (sizeof(counter_events) / sizeof(counter_events[0])))
+
+struct counters {
+  int fd[NUM_COUNTERS];         // -1 if the counter is unavailable
+  double value[NUM_COUNTERS];
+  double start, elapsed;
+};
+
+// Opens the counters, disabled; returns how many are available
+static int counters_open(struct counters *c)
+{
+  int available = 0;
+
+  for (int i = 0; i < NUM_COUNTERS; i++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter_events[i].type;
+    attr.config = counter_events[i].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // Counting this thread only, on any CPU
+    c->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (c->fd[i] >= 0)
+      available++;
+  }
+
+  return available;
+}
+
+static void counters_close(struct counters *c)
+{
+  for (int i = 0; i < NUM_COUNTERS; i++)
+    if (c->fd[i] >= 0)
+      close(c->fd[i]);
+}
+
+static void counters_start(struct counters *c)
+{
+  for (int i = 0; i < NUM_COUNTERS; i++) {
+    if (c->fd[i] >= 0) {
+      ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+  c->start = now();
+}
+
+static void counters_stop(struct counters *c)
+{
+  c->elapsed = now() - c->start;
+
+  for (int i = 0; i < NUM_COUNTERS; i++) {
+    uint64_t data[3];     // value, time enabled, time running
+
+    c->value[i] = -1;
+    if (c->fd[i] < 0)
+      continue;
+    ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    if (read(c->fd[i], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+      continue;
+
+    // Scale up if the kernel had to multiplex the counters
+    c->value[i] = (double) data[0] * data[1] / data[2];
+  }
+}
+
+static void counters_report(const char *op, struct counters *c, long elements)
+{
+  printf("  %-16s %8.1f", op, c->elapsed * 1e9 / elements);
+  for (int i = 0; i < NUM_COUNTERS; i++) {
+    if (c->value[i] < 0)
+      printf(" %9s", "n/a");
+    else
+      printf(" %9.2f", c->value[i] / elements);
+  }
+  printf("\n");
+}
+
+static void bench_counters()
+{
+  char (*keys)[16] = malloc(COUNTER_LENGTH * sizeof(*keys));
+  struct counters c;
+  long sum = 0;
+
+  srand(31);
+  for (int i = 0; i < COUNTER_LENGTH; i++)
+    snprintf(keys[i], sizeof(keys[i]), "%08x", rand());
+
+  int available = counters_open(&c);
+  printf("hardware counters per element (%d of %d counters available)\n",
+         available, NUM_COUNTERS);
+  printf("  %-16s %8s", "operation", "ns");
+  for (int i = 0; i < NUM_COUNTERS; i++)
+    printf(" %9s", counter_events[i].name);
+  printf("\n");
+
+  CList list = CL_new();
+  counters_start(&c);
+  for (int i = 0; i < COUNTER_LENGTH; i++)
+    CL_push(list, keys[i]);
+  counters_stop(&c);
+  counters_report("CL_push", &c, COUNTER_LENGTH);
+
+  counters_start(&c);
+  CL_foreach(list, count_cb, &sum);
+  counters_stop(&c);
+  counters_report("CL_foreach", &c, COUNTER_LENGTH);
+
+  counters_start(&c);
+  CList copy = CL_copy(list);
+  counters_stop(&c);
+  counters_report("CL_copy", &c, COUNTER_LENGTH);
+
+  counters_start(&c);
+  CL_sort(copy);
+  counters_stop(&c);
+  counters_report("CL_sort", &c, COUNTER_LENGTH);
+
+  counters_start(&c);
+  CL_free(copy);
+  counters_stop(&c);
+  counters_report("CL_free", &c, COUNTER_LENGTH);
+
+  CList sorted = CL_new();
+  counters_start(&c);
+  for (int i = 0; i < COUNTER_SMALL; i++)
+    CL_insert_sorted(sorted, keys[i]);
+  counters_stop(&c);
+  counters_report("CL_insert_sorted", &c, COUNTER_SMALL);
+
+  counters_start(&c);
+  for (int i = 0; i < COUNTER_SMALL; i++)
+    sum += (CL_nth(sorted, i) != NULL);
+  counters_stop(&c);
+  counters_report("CL_nth (seq)", &c, COUNTER_SMALL);
+
+  counters_start(&c);
+  for (int i = 0; i < COUNTER_SMALL; i++)
+    CL_append(sorted, keys[i]);
+  counters_stop(&c);
+  counters_report("CL_append", &c, COUNTER_SMALL);
+
+  if (available == 0)
+    printf("  (perf_event_open unavailable; check kernel.perf_event_paranoid)\n");
+
+  counters_close(&c);
+  CL_free(sorted);
+  CL_free(list);
+  free(keys);
+  if (sum == 42)
+    printf("\n");   // keep sum alive
+}
+
+
+/*
+ * Sequential indexing: the legacy idiom of calling CL_nth for each
+ * position in turn. Each length is timed; linear growth means each
+ * call costs O(1).
+ */
+static void bench_sequential_index()
+{
+  const int lengths[] = { 10000, 100000, 1000000 };
+  long sum = 0;
+
+  printf("sequential CL_nth loop\n");
+
+  for (int l = 0; l < 3; l++) {
+    CList list = CL_new();
+    for (int i = 0; i < lengths[l]; i++)
+      CL_push(list, "x");
+
+    double start = now();
+    for (int i = 0; i < CL_length(list); i++)
+      sum += (CL_nth(list, i) != NULL);
+    double elapsed = now() - start;
+
+    printf("  %8d nodes: %8.2f ms (%5.1f ns/call)\n", lengths[l],
+           elapsed * 1e3, elapsed * 1e9 / lengths[l]);
+    CL_free(list);
+  }
+
+  if (sum == 42)
+    printf("\n");   // keep sum alive
+}
+
+
+/*
+ * External sort of inputs several times larger than the memory budget
+ */
+#define EXTERNAL_BUDGET  (16 << 20)
+
+static void bench_external()
+{
+  const int multiples[] = { 2, 4, 8 };
+
+  printf("external sort (%d MB budget, 15-byte records)\n", EXTERNAL_BUDGET >> 20);
+
+  for (int m = 0; m < 3; m++) {
+    // Input size, not counting the nodes a run also needs
+    long records = (long) multiples[m] * EXTERNAL_BUDGET / 15;
+    FILE *in = tmpfile(), *out = tmpfile();
+    if (in == NULL || out == NULL) {
+      printf("  cannot create temporary files\n");
+      return;
+    }
+
+    srand(41);
+    for (long i = 0; i < records; i++)
+      fprintf(in, "%08x%06x\n", rand(), rand() & 0xffffff);
+    long bytes = ftell(in);
+    rewind(in);
+
+    double start = now();
+    bool ok = CL_sort_external(in, out, '\n', "/tmp", EXTERNAL_BUDGET);
+    double elapsed = now() - start;
+
+    printf("  %dx budget: %8ld records, %6.1f MB in %7.1f ms (%6.1f MB/s)%s\n",
+           multiples[m], records, bytes / 1e6, elapsed * 1e3,
+           bytes / 1e6 / elapsed, ok ? "" : " FAILED");
+    fclose(in);
+    fclose(out);
+  }
+}
+
+
+/*
+ * Shared compact list: worker processes attach to a list built once,
+ * against each worker rebuilding its own copy
+ */
+#define SHARED_LENGTH   2000000
+#define SHARED_WORKERS  4
+
+static void shared_count_cb(int64_t pos, CListElementType element, void *cb_data)
+{
+  (*(long *) cb_data)++;
+}
+
+static void bench_shared()
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/clist_bench_%d", (int) getpid());
+
+  printf("shared compact list (%d nodes, %d worker processes)\n",
+         SHARED_LENGTH, SHARED_WORKERS);
+
+  double start = now();
+  CListCompact list = CL_compact_create_shared(name, SHARED_LENGTH, 1 << 20);
+  if (list == NULL) {
+    printf("  cannot create shared memory segment\n");
+    return;
+  }
+  for (int i = 0; i < SHARED_LENGTH; i++)
+    CL_compact_append(list, (i / 1000 % 2) ? "odd" : "even");
+  printf("  build once:         %7.1f ms\n", (now() - start) * 1e3);
+
+  for (int mode = 0; mode < 2; mode++) {
+    start = now();
+    for (int w = 0; w < SHARED_WORKERS; w++) {
+      if (fork() != 0)
+        continue;
+
+      long sum = 0;
+      CListCompact view;
+      if (mode == 0) {
+        view = CL_compact_new();
+        for (int i = 0; i < SHARED_LENGTH; i++)
+          CL_compact_append(view, (i / 1000 % 2) ? "odd" : "even");
+      } else {
+        view = CL_compact_attach_shared(name);
+      }
+      CL_compact_foreach(view, shared_count_cb, &sum);
+      CL_compact_free(view);
+      _exit(sum == SHARED_LENGTH ? 0 : 1);
+    }
+
+    bool ok = true;
+    for (int w = 0; w < SHARED_WORKERS; w++) {
+      int status;
+      ok = ok && wait(&status) > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    printf("  workers %-10s %7.1f ms%s\n", mode == 0 ? "rebuild:" : "attach:",
+           (now() - start) * 1e3, ok ? "" : " FAILED");
+  }
+
+  CL_compact_free(list);
+  CL_compact_unlink_shared(name);
+}
+
+
+/*
+ * Journaled pushes per second at each durability setting, and the time
+ * to replay the log on reopen
+ */
+#define JOURNAL_SECONDS  0.5
+
+static void bench_journal()
+{
+  const int syncs[] = { 0, 1, 10, CL_JOURNAL_NO_SYNC };
+  char path[64], snap_path[80];
+  snprintf(path, sizeof(path), "/tmp/clist_bench_journal_%d", (int) getpid());
+  snprintf(snap_path, sizeof(snap_path), "%s.snap", path);
+
+  printf("journal (push for %.1f s, then reopen)\n", JOURNAL_SECONDS);
+
+  for (int m = 0; m < 4; m++) {
+    unlink(path);
+    unlink(snap_path);
+    CListJournal journal = CL_journal_open(path, syncs[m]);
+    if (journal == NULL) {
+      printf("  cannot open %s\n", path);
+      return;
+    }
+
+    long ops = 0;
+    double start = now(), elapsed;
+    do {
+      for (int i = 0; i < 64; i++, ops++)
+        CL_journal_push(journal, "journal bench");
+      elapsed = now() - start;
+    } while (elapsed < JOURNAL_SECONDS);
+    bool ok = CL_journal_close(journal);
+
+    start = now();
+    journal = CL_journal_open(path, CL_JOURNAL_NO_SYNC);
+    double replay = now() - start;
+    ok = ok && journal != NULL && CL_length64(CL_journal_list(journal)) == ops;
+    CL_journal_close(journal);
+
+    char label[32];
+    if (syncs[m] == CL_JOURNAL_NO_SYNC)
+      snprintf(label, sizeof(label), "no sync:");
+    else if (syncs[m] == 0)
+      snprintf(label, sizeof(label), "sync each:");
+    else
+      snprintf(label, sizeof(label), "every %d ms:", syncs[m]);
+    printf("  %-12s %10.0f ops/s, replay %8ld in %7.1f ms%s\n", label,
+           ops / elapsed, ops, replay * 1e3, ok ? "" : " FAILED");
+  }
+
+  unlink(path);
+  unlink(snap_path);
+}
+
+
+/*
+ * Cache recency updates: moving a random element to the front with
+ * CL_remove and CL_push, against CL_lru_touch on its handle, and a
+ * full cache replacing its oldest entry on each miss
+ */
+#define LRU_LENGTH   10000
+#define LRU_TOUCHES  20000
+
+static void bench_lru()
+{
+  static char keys[LRU_LENGTH][12];
+  static CListLRUHandle handles[LRU_LENGTH];
+
+  printf("lru (%d elements, %d touches)\n", LRU_LENGTH, LRU_TOUCHES);
+
+  CList list = CL_new();
+  CListLRU lru = CL_lru_new(true);
+  for (int i = 0; i < LRU_LENGTH; i++) {
+    snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+    CL_push(list, keys[i]);
+    handles[i] = CL_lru_push(lru, keys[i]);
+  }
+
+  srand(45);
+  double start = now();
+  for (int i = 0; i < LRU_TOUCHES; i++)
+    CL_push(list, CL_remove(list, rand() % LRU_LENGTH));
+  double elapsed = now() - start;
+  printf("  remove + push:  %8.1f ns/op\n", elapsed * 1e9 / LRU_TOUCHES);
+
+  srand(45);
+  start = now();
+  for (int i = 0; i < LRU_TOUCHES; i++)
+    CL_lru_touch(lru, handles[rand() % LRU_LENGTH]);
+  elapsed = now() - start;
+  printf("  lru touch:      %8.1f ns/op\n", elapsed * 1e9 / LRU_TOUCHES);
+
+  // Look up keys from twice the cache's capacity; on a miss, evict the
+  // oldest and push the new key in its node
+  static char misses[LRU_LENGTH][12];
+  int hits = 0;
+  srand(45);
+  start = now();
+  for (int i = 0; i < LRU_TOUCHES; i++) {
+    int k = rand() % (2 * LRU_LENGTH);
+    char key[12];
+    snprintf(key, sizeof(key), "key%d", k);
+    CListLRUHandle handle = CL_lru_find(lru, key);
+    if (handle != NULL) {
+      CL_lru_touch(lru, handle);
+      hits++;
+    } else {
+      CL_lru_evict_tail(lru);
+      char *slot = (k < LRU_LENGTH) ? keys[k] : misses[k - LRU_LENGTH];
+      strcpy(slot, key);
+      CL_lru_push(lru, slot);
+    }
+  }
+  elapsed = now() - start;
+  printf("  find + touch/evict: %6.1f ns/op (%d%% hits)\n",
+         elapsed * 1e9 / LRU_TOUCHES, hits * 100 / LRU_TOUCHES);
+
+  CL_free(list);
+  CL_lru_free(lru);
+}
+
+
+/*
+ * A scheduler queue under backlog: enqueue a batch of random keys with
+ * CL_insert_sorted, then drain it with CL_pop, on an ordinary sorted
+ * list and on a priority-queue list
+ */
+static void bench_queue()
+{
+  const int sizes[] = { 1000, 10000, 30000 };
+  static char keys[30000][12];
+
+  printf("priority queue (enqueue n, then pop all)\n");
+
+  srand(46);
+  for (int i = 0; i < 30000; i++)
+    snprintf(keys[i], sizeof(keys[i]), "%08x", rand());
+
+  for (int s = 0; s < 3; s++) {
+    int n = sizes[s];
+    double elapsed[2];
+    bool ok = true;
+
+    for (int mode = 0; mode < 2; mode++) {
+      CList list = (mode == 0) ? CL_new() : CL_new_priority_queue();
+      double start = now();
+      for (int i = 0; i < n; i++)
+        CL_insert_sorted(list, keys[i]);
+      CListElementType prev = "";
+      for (int i = 0; i < n; i++) {
+        CListElementType element = CL_pop(list);
+        ok = ok && strcmp(prev, element) <= 0;
+        prev = element;
+      }
+      elapsed[mode] = now() - start;
+      CL_free(list);
+    }
+
+    printf("  n=%6d: sorted list %9.1f ns/op, queue %6.1f ns/op%s\n", n,
+           elapsed[0] * 1e9 / (2 * n), elapsed[1] * 1e9 / (2 * n), ok ? "" : " FAILED");
+  }
+}
+
+
+/*
+ * Reading the middle half of a list backwards: copying the range with
+ * CL_nth and CL_push, reversing the list in place and back, and a
+ * reversed view
+ */
+#define VIEW_LENGTH  1000000
+
+static void bench_view()
+{
+  printf("view (middle %d of %d elements, reversed)\n", VIEW_LENGTH / 2, VIEW_LENGTH);
+
+  CList list = CL_new();
+  for (int i = 0; i < VIEW_LENGTH; i++)
+    CL_push(list, (i % 2) ? "odd" : "even");
+  int64_t from = VIEW_LENGTH / 4, to = from + VIEW_LENGTH / 2;
+
+  long count = 0;
+  double start = now();
+  CList copy = CL_new();
+  for (int64_t i = from; i < to; i++)
+    CL_push(copy, CL_nth64(list, i));
+  CL_foreach64(copy, shared_count_cb, &count);
+  CL_free(copy);
+  printf("  copy:          %7.1f ms\n", (now() - start) * 1e3);
+
+  start = now();
+  CL_reverse(list);
+  CListView view = CL_view_new(list, VIEW_LENGTH - to, VIEW_LENGTH - from, false);
+  CL_view_foreach(view, shared_count_cb, &count);
+  CL_view_free(view);
+  CL_reverse(list);
+  printf("  reverse twice: %7.1f ms\n", (now() - start) * 1e3);
+
+  start = now();
+  view = CL_view_new(list, from, to, true);
+  CL_view_foreach(view, shared_count_cb, &count);
+  CL_view_free(view);
+  printf("  reversed view: %7.1f ms%s\n", (now() - start) * 1e3,
+         count == 3 * (to - from) ? "" : " FAILED");
+
+  CL_free(list);
+}
+
+
+static const struct {
+  const char *name;
+  void (*run)(void);
+} benchmarks[] = {
+  { "allocator", bench_allocator },
+  { "sort", bench_sort },
+  { "read-scaling", bench_read_scaling },
+  { "compact", bench_compact },
+  { "free-latency", bench_free_latency },
+  { "counters", bench_counters },
+  { "sequential-index", bench_sequential_index },
+  { "external", bench_external },
+  { "shared", bench_shared },
+  { "journal", bench_journal },
+  { "lru", bench_lru },
+  { "queue", bench_queue },
+  { "view", bench_view },
+};
+
+static const int num_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+
+int main(int argc, char *argv[])
+{
+  for (int b = 0; b < num_benchmarks; b++) {
+    bool selected = (argc == 1);
+    for (int i = 1; i < argc; i++)
+      if (strcmp(argv[i], benchmarks[b].name) == 0)
+        selected = true;
+
+    if (selected) {
+      benchmarks[b].run();
+      printf("\n");
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,667 @@
+/*
+ * clist_compact.c
+ *
+ * Compact list storage: index-linked node pool plus string arena
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "clist_compact.h"
+
+
+// Marks the end of a chain
+#define CLC_NIL UINT32_MAX
+
+// Largest pool and arena; indices and offsets are 32 bits
+#define CLC_MAX_NODES  ((uint64_t) CLC_NIL)
+#define CLC_MAX_ARENA  ((uint64_t) 1 << 32)
+
+// The pool and the arena are addressed through tables of chunks: the
+// high bits of an index or offset pick the chunk, the low bits the
+// place within it. A private list adds a chunk whenever it fills one,
+// so nothing ever moves; a shared list's chunks are just consecutive
+// pieces of its segment.
+#define CLC_NODE_CHUNK_BITS   16
+#define CLC_NODE_CHUNK        ((uint64_t) 1 << CLC_NODE_CHUNK_BITS)
+#define CLC_ARENA_CHUNK_BITS  20
+#define CLC_ARENA_CHUNK       ((uint64_t) 1 << CLC_ARENA_CHUNK_BITS)
+
+struct _clc_node {
+  uint32_t element;             // offset of the string in the arena
+  uint32_t next;                // index of the next node, or CLC_NIL
+};
+
+// Identifies a shared segment holding a compact list
+#define CLC_MAGIC  0x434c4973744331ULL
+
+// Everything needed to use the list lives in this header and the
+// region that follows it, with no pointers, so the region can be
+// mapped at a different address in each process that shares it.
+struct _clc_header {
+  uint64_t magic;
+  pthread_rwlock_t lock;        // process-shared; used by shared lists only
+  uint64_t length;
+  uint32_t head, tail;
+  uint32_t free_list;           // chain of nodes released by pop
+  uint32_t last_string;         // arena offset of the last string added
+  uint64_t nodes_used;          // nodes ever taken from the pool
+  uint64_t node_cap;
+  uint64_t arena_used;
+  uint64_t arena_cap;
+  uint64_t nodes_offset;        // from the start of the region
+  uint64_t arena_offset;
+};
+
+struct _cl_compact {
+  struct _clc_header *hdr;      // in the segment if shared, else malloc'd
+  struct _clc_node **node_chunks;
+  char **arena_chunks;
+  size_t node_slots, arena_slots;       // allocated table entries
+
+  // Private lists: the arena's allocations, which may each span
+  // several chunks
+  char **arena_blocks;
+  size_t num_blocks;
+
+  void *region;                 // shared lists: the mapped segment
+  size_t region_len;
+  bool shared;                  // in a shm segment, so hdr->lock is used
+};
+
+#define _CLC_NODE(list, index) \
+  (&(list)->node_chunks[(index) >> CLC_NODE_CHUNK_BITS][(index) & (CLC_NODE_CHUNK - 1)])
+#define _CLC_STRING(list, offset) \
+  ((list)->arena_chunks[(offset) >> CLC_ARENA_CHUNK_BITS] + ((offset) & (CLC_ARENA_CHUNK - 1)))
+
+// A walk along the list that remembers which chunk it is in. Consecutive
+// nodes are usually in the same chunk, and skipping the table load
+// takes it off the chain of dependent loads from one node to the next.
+struct _clc_walk {
+  struct _clc_node **chunks;
+  uint32_t chunk;
+  struct _clc_node *base;
+};
+
+static inline struct _clc_node *_CLC_walk_node(struct _clc_walk *walk, uint32_t index)
+{
+  if ((index >> CLC_NODE_CHUNK_BITS) != walk->chunk) {
+    walk->chunk = index >> CLC_NODE_CHUNK_BITS;
+    walk->base = walk->chunks[walk->chunk];
+  }
+  return &walk->base[index & (CLC_NODE_CHUNK - 1)];
+}
+
+
+
+/*
+ * Lay out a header, pool and arena in a region of memory
+ *
+ * Parameters:
+ *   hdr        the header, at the start of the region
+ *   node_cap   number of nodes the pool can hold
+ *   arena_cap  number of bytes the arena can hold
+ *
+ * Returns: The region size required
+ */
+static size_t _CLC_layout(struct _clc_header *hdr, uint64_t node_cap, uint64_t arena_cap)
+{
+  hdr->magic = CLC_MAGIC;
+  hdr->length = 0;
+  hdr->head = hdr->tail = hdr->free_list = CLC_NIL;
+  hdr->last_string = 0;
+  hdr->nodes_used = 0;
+  hdr->node_cap = node_cap;
+  hdr->arena_used = 0;
+  hdr->arena_cap = arena_cap;
+  hdr->nodes_offset = (sizeof(*hdr) + 63) & ~(uint64_t) 63;
+  hdr->arena_offset = hdr->nodes_offset + node_cap * sizeof(struct _clc_node);
+
+  return hdr->arena_offset + arena_cap;
+}
+
+
+
+/*
+ * Fill in the chunk tables of a shared list from its header
+ */
+static void _CLC_attach(CListCompact list)
+{
+  struct _clc_header *hdr = list->hdr;
+  struct _clc_node *nodes = (struct _clc_node *) ((char *) hdr + hdr->nodes_offset);
+  char *arena = (char *) hdr + hdr->arena_offset;
+
+  list->node_slots = (hdr->node_cap + CLC_NODE_CHUNK - 1) >> CLC_NODE_CHUNK_BITS;
+  list->arena_slots = (hdr->arena_cap + CLC_ARENA_CHUNK - 1) >> CLC_ARENA_CHUNK_BITS;
+  list->node_chunks = malloc((list->node_slots + 1) * sizeof(struct _clc_node *));
+  list->arena_chunks = malloc((list->arena_slots + 1) * sizeof(char *));
+  assert(list->node_chunks && list->arena_chunks);
+
+  for (size_t i = 0; i < list->node_slots; i++)
+    list->node_chunks[i] = nodes + i * CLC_NODE_CHUNK;
+  for (size_t i = 0; i < list->arena_slots; i++)
+    list->arena_chunks[i] = arena + i * CLC_ARENA_CHUNK;
+
+  list->arena_blocks = NULL;
+  list->num_blocks = 0;
+}
+
+
+
+/*
+ * Add a chunk to a private list's pool
+ *
+ * Returns: true on success, false if the pool is at its largest or
+ *   memory is exhausted
+ */
+static bool _CLC_grow_pool(CListCompact list)
+{
+  struct _clc_header *hdr = list->hdr;
+
+  if (hdr->node_cap >= CLC_MAX_NODES)
+    return false;
+
+  size_t slot = hdr->node_cap >> CLC_NODE_CHUNK_BITS;
+  if (slot == list->node_slots) {
+    list->node_slots = list->node_slots ? 2 * list->node_slots : 16;
+    list->node_chunks = realloc(list->node_chunks,
+                                list->node_slots * sizeof(struct _clc_node *));
+    assert(list->node_chunks);
+  }
+
+  struct _clc_node *chunk = malloc(CLC_NODE_CHUNK * sizeof(struct _clc_node));
+  if (chunk == NULL)
+    return false;
+  list->node_chunks[slot] = chunk;
+
+  hdr->node_cap += CLC_NODE_CHUNK;
+  if (hdr->node_cap > CLC_MAX_NODES)
+    hdr->node_cap = CLC_MAX_NODES;
+
+  return true;
+}
+
+
+
+/*
+ * Add room for a string of len bytes at the end of a private list's
+ * arena. Whatever is left of the last chunk is skipped, so that the
+ * string lies in one allocation; a string longer than a chunk gets
+ * an allocation spanning as many chunks as it needs.
+ *
+ * Returns: true on success, false if the arena is at its largest or
+ *   memory is exhausted
+ */
+static bool _CLC_grow_arena(CListCompact list, size_t len)
+{
+  struct _clc_header *hdr = list->hdr;
+  uint64_t nchunks = (len + CLC_ARENA_CHUNK - 1) >> CLC_ARENA_CHUNK_BITS;
+
+  if (hdr->arena_cap + nchunks * CLC_ARENA_CHUNK > CLC_MAX_ARENA)
+    return false;
+
+  size_t slot = hdr->arena_cap >> CLC_ARENA_CHUNK_BITS;
+  if (slot + nchunks > list->arena_slots) {
+    while (slot + nchunks > list->arena_slots)
+      list->arena_slots = list->arena_slots ? 2 * list->arena_slots : 16;
+    list->arena_chunks = realloc(list->arena_chunks, list->arena_slots * sizeof(char *));
+    assert(list->arena_chunks);
+  }
+
+  char *block = malloc(nchunks * CLC_ARENA_CHUNK);
+  if (block == NULL)
+    return false;
+  list->arena_blocks = realloc(list->arena_blocks, (list->num_blocks + 1) * sizeof(char *));
+  assert(list->arena_blocks);
+  list->arena_blocks[list->num_blocks++] = block;
+
+  for (uint64_t i = 0; i < nchunks; i++)
+    list->arena_chunks[slot + i] = block + i * CLC_ARENA_CHUNK;
+  hdr->arena_used = hdr->arena_cap;
+  hdr->arena_cap += nchunks * CLC_ARENA_CHUNK;
+
+  return true;
+}
+
+
+
+/*
+ * Lock a shared list for reading or writing. Private lists are not
+ * locked, as with CList.
+ */
+static void _CLC_read_lock(CListCompact list)
+{
+  if (list->shared)
+    pthread_rwlock_rdlock(&list->hdr->lock);
+}
+
+static void _CLC_write_lock(CListCompact list)
+{
+  if (list->shared)
+    pthread_rwlock_wrlock(&list->hdr->lock);
+}
+
+static void _CLC_unlock(CListCompact list)
+{
+  if (list->shared)
+    pthread_rwlock_unlock(&list->hdr->lock);
+}
+
+
+
+// Documented in .h file
+CListCompact CL_compact_new()
+{
+  CListCompact list = malloc(sizeof(struct _cl_compact));
+  list->hdr = malloc(sizeof(struct _clc_header));
+  assert(list && list->hdr);
+
+  // Start with no chunks; the offsets are unused
+  _CLC_layout(list->hdr, 0, 0);
+  list->node_chunks = NULL;
+  list->arena_chunks = NULL;
+  list->node_slots = list->arena_slots = 0;
+  list->arena_blocks = NULL;
+  list->num_blocks = 0;
+  list->region = NULL;
+  list->region_len = 0;
+  list->shared = false;
+
+  return list;
+}
+
+
+
+// Documented in .h file
+CListCompact CL_compact_create_shared(const char *name, uint64_t max_nodes, uint64_t arena_bytes)
+{
+  assert(name);
+
+  if (max_nodes == 0 || max_nodes > CLC_MAX_NODES
+      || arena_bytes == 0 || arena_bytes > CLC_MAX_ARENA)
+    return NULL;
+
+  struct _clc_header layout;
+  size_t len = _CLC_layout(&layout, max_nodes, arena_bytes);
+
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0)
+    return NULL;
+
+  // Allocate the whole segment now. Left sparse, a write into a hole
+  // once the filesystem is full would raise SIGBUS in whichever process
+  // made it, instead of the push or append failing.
+  void *region = MAP_FAILED;
+  if (ftruncate(fd, len) == 0 && posix_fallocate(fd, 0, len) == 0)
+    region = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+  close(fd);
+  if (region == MAP_FAILED) {
+    shm_unlink(name);
+    return NULL;
+  }
+
+  CListCompact list = malloc(sizeof(struct _cl_compact));
+  assert(list);
+  list->region = region;
+  list->region_len = len;
+  list->shared = true;
+  list->hdr = region;
+
+  // Another process may attach as soon as the segment exists, so the
+  // magic number goes in last, once the header and its lock are ready
+  layout.magic = 0;
+  *list->hdr = layout;
+  _CLC_attach(list);
+
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_rwlock_init(&list->hdr->lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+
+  __atomic_store_n(&list->hdr->magic, CLC_MAGIC, __ATOMIC_RELEASE);
+
+  return list;
+}
+
+
+
+// Documented in .h file
+CListCompact CL_compact_attach_shared(const char *name)
+{
+  assert(name);
+
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  void *region = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(struct _clc_header))
+    region = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0);
+  close(fd);
+  if (region == MAP_FAILED)
+    return NULL;
+
+  // Check that this is a compact list, that its creator has finished
+  // setting it up, and that all of it is there
+  struct _clc_header *hdr = region;
+  if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != CLC_MAGIC
+      || hdr->arena_offset + hdr->arena_cap > (uint64_t) st.st_size) {
+    munmap(region, st.st_size);
+    return NULL;
+  }
+
+  CListCompact list = malloc(sizeof(struct _cl_compact));
+  assert(list);
+  list->region = region;
+  list->region_len = st.st_size;
+  list->shared = true;
+  list->hdr = hdr;
+  _CLC_attach(list);
+
+  return list;
+}
+
+
+
+// Documented in .h file
+bool CL_compact_unlink_shared(const char *name)
+{
+  assert(name);
+
+  return shm_unlink(name) == 0;
+}
+
+
+
+// Documented in .h file
+void CL_compact_free(CListCompact list)
+{
+  if (list == NULL)
+    return;
+
+  if (list->shared) {
+    munmap(list->region, list->region_len);
+  } else {
+    for (size_t i = 0; i < (list->hdr->node_cap + CLC_NODE_CHUNK - 1) >> CLC_NODE_CHUNK_BITS; i++)
+      free(list->node_chunks[i]);
+    for (size_t i = 0; i < list->num_blocks; i++)
+      free(list->arena_blocks[i]);
+    free(list->hdr);
+  }
+  free(list->node_chunks);
+  free(list->arena_chunks);
+  free(list->arena_blocks);
+  free(list);
+}
+
+
+
+// Documented in .h file
+int64_t CL_compact_length(CListCompact list)
+{
+  assert(list);
+
+  _CLC_read_lock(list);
+  int64_t length = list->hdr->length;
+  _CLC_unlock(list);
+
+  return length;
+}
+
+
+
+/*
+ * Store a copy of element in the arena. Consecutive copies of the same
+ * string share one arena entry.
+ *
+ * Parameters:
+ *   list     the list
+ *   element  the string to store
+ *   offset   set to the string's arena offset
+ *
+ * Returns: true on success, false if the arena is full
+ */
+static bool _CLC_store_string(CListCompact list, CListElementType element, uint32_t *offset)
+{
+  struct _clc_header *hdr = list->hdr;
+
+  if (hdr->arena_used > 0 && strcmp(_CLC_STRING(list, hdr->last_string), element) == 0) {
+    *offset = hdr->last_string;
+    return true;
+  }
+
+  size_t len = strlen(element) + 1;
+  if (hdr->arena_used + len > hdr->arena_cap
+      && (list->shared || !_CLC_grow_arena(list, len)))
+    return false;
+
+  memcpy(_CLC_STRING(list, hdr->arena_used), element, len);
+  *offset = hdr->last_string = hdr->arena_used;
+  hdr->arena_used += len;
+
+  return true;
+}
+
+
+
+/*
+ * Take a node from the free list or the pool and store element in it
+ *
+ * Returns: The node's index, or CLC_NIL if the pool or arena is full
+ */
+static uint32_t _CLC_new_node(CListCompact list, CListElementType element)
+{
+  struct _clc_header *hdr = list->hdr;
+  uint32_t offset;
+  uint32_t index;
+
+  if (hdr->free_list == CLC_NIL && hdr->nodes_used >= hdr->node_cap
+      && (list->shared || !_CLC_grow_pool(list)))
+    return CLC_NIL;
+  if (!_CLC_store_string(list, element, &offset))
+    return CLC_NIL;
+
+  if (hdr->free_list != CLC_NIL) {
+    index = hdr->free_list;
+    hdr->free_list = _CLC_NODE(list, index)->next;
+  } else {
+    index = hdr->nodes_used++;
+  }
+
+  _CLC_NODE(list, index)->element = offset;
+  _CLC_NODE(list, index)->next = CLC_NIL;
+
+  return index;
+}
+
+
+
+// Documented in .h file
+bool CL_compact_push(CListCompact list, CListElementType element)
+{
+  assert(list);
+  assert(element);
+
+  _CLC_write_lock(list);
+  uint32_t index = _CLC_new_node(list, element);
+  if (index == CLC_NIL) {
+    _CLC_unlock(list);
+    return false;
+  }
+
+  struct _clc_header *hdr = list->hdr;
+  _CLC_NODE(list, index)->next = hdr->head;
+  hdr->head = index;
+  if (hdr->tail == CLC_NIL)
+    hdr->tail = index;
+  hdr->length++;
+  _CLC_unlock(list);
+
+  return true;
+}
+
+
+
+// Documented in .h file
+bool CL_compact_append(CListCompact list, CListElementType element)
+{
+  assert(list);
+  assert(element);
+
+  _CLC_write_lock(list);
+  uint32_t index = _CLC_new_node(list, element);
+  if (index == CLC_NIL) {
+    _CLC_unlock(list);
+    return false;
+  }
+
+  struct _clc_header *hdr = list->hdr;
+  if (hdr->tail == CLC_NIL)
+    hdr->head = index;
+  else
+    _CLC_NODE(list, hdr->tail)->next = index;
+  hdr->tail = index;
+  hdr->length++;
+  _CLC_unlock(list);
+
+  return true;
+}
+
+
+
+// Documented in .h file
+CListElementType CL_compact_pop(CListCompact list)
+{
+  assert(list);
+
+  struct _clc_header *hdr = list->hdr;
+  _CLC_write_lock(list);
+  uint32_t index = hdr->head;
+
+  if (index == CLC_NIL) {
+    _CLC_unlock(list);
+    return INVALID_RETURN;
+  }
+
+  struct _clc_node *node = _CLC_NODE(list, index);
+  CListElementType ret = _CLC_STRING(list, node->element);
+
+  hdr->head = node->next;
+  if (hdr->head == CLC_NIL)
+    hdr->tail = CLC_NIL;
+  node->next = hdr->free_list;
+  hdr->free_list = index;
+  hdr->length--;
+  _CLC_unlock(list);
+
+  return ret;
+}
+
+
+
+// Documented in .h file
+CListElementType CL_compact_nth(CListCompact list, int64_t pos)
+{
+  assert(list);
+
+  _CLC_read_lock(list);
+  int64_t length = list->hdr->length;
+
+  if (pos < -length || pos >= length) {
+    _CLC_unlock(list);
+    return INVALID_RETURN;
+  }
+
+  if (pos < 0)
+    pos = length + pos;
+
+  uint32_t index = (pos == length - 1) ? list->hdr->tail : list->hdr->head;
+  if (pos != length - 1) {
+    struct _clc_walk walk = { list->node_chunks, UINT32_MAX, NULL };
+    for (int64_t i = 0; i < pos; i++)
+      index = _CLC_walk_node(&walk, index)->next;
+  }
+  CListElementType element = _CLC_STRING(list, _CLC_NODE(list, index)->element);
+  _CLC_unlock(list);
+
+  return element;
+}
+
+
+
+// Documented in .h file
+void CL_compact_foreach(CListCompact list, CL_compact_callback callback, void *cb_data)
+{
+  assert(list);
+  assert(callback);
+
+  int64_t pos = 0;
+  _CLC_read_lock(list);
+
+  // Nothing can add a chunk while we hold the list, so the tables can
+  // be kept in locals instead of reloaded around every callback
+  struct _clc_walk walk = { list->node_chunks, UINT32_MAX, NULL };
+  char **arena_chunks = list->arena_chunks;
+
+  for (uint32_t index = list->hdr->head; index != CLC_NIL; ) {
+    struct _clc_node *node = _CLC_walk_node(&walk, index);
+    uint32_t offset = node->element;
+    callback(pos++, arena_chunks[offset >> CLC_ARENA_CHUNK_BITS] + (offset & (CLC_ARENA_CHUNK - 1)),
+             cb_data);
+    index = node->next;
+  }
+  _CLC_unlock(list);
+}
+
+
+
+// State for CL_compact_append_list
+struct _clc_append_state {
+  CListCompact list;
+  bool ok;
+};
+
+static void _CLC_append_cb(int64_t pos, CListElementType element, void *cb_data)
+{
+  struct _clc_append_state *state = cb_data;
+
+  if (state->ok)
+    state->ok = CL_compact_append(state->list, element);
+}
+
+
+
+// Documented in .h file
+bool CL_compact_append_list(CListCompact list, CList src)
+{
+  assert(list);
+  assert(src);
+
+  struct _clc_append_state state = { list, true };
+  CL_foreach64(src, _CLC_append_cb, &state);
+
+  return state.ok;
+}
+
+
+
+// Documented in .h file
+size_t CL_compact_memory(CListCompact list)
+{
+  assert(list);
+
+  _CLC_read_lock(list);
+  size_t used = list->hdr->nodes_used * sizeof(struct _clc_node) + list->hdr->arena_used;
+  _CLC_unlock(list);
+
+  return used;
+}
@@ -0,0 +1,208 @@
+/*
+ * clist_compact.h
+ *
+ * Compact list storage for very long lists of strings
+ *
+ * A CListCompact keeps its nodes in one pool array and links them by
+ * 32-bit index instead of by pointer, and keeps the strings themselves
+ * in an append-only arena addressed by 32-bit offset. Each node is
+ * therefore 8 bytes, against 16 bytes plus malloc overhead (typically
+ * 32 bytes in all) for a CList node. The pool and the arena grow in
+ * chunks as they fill, and a chunk is never moved or released before
+ * the list is freed, so elements never move once appended.
+ *
+ * Unlike a CList, a CListCompact copies the strings it is given.
+ *
+ * Because the list holds no pointers, it can also live in a POSIX
+ * shared-memory segment (see CL_compact_create_shared), which other
+ * processes attach to and read in place. Operations on a shared list
+ * take a process-shared reader-writer lock kept in the segment, so any
+ * number of processes may read while one at a time writes. Private
+ * lists are not locked.
+ */
+
+#ifndef _CLIST_COMPACT_H_
+#define _CLIST_COMPACT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "clist.h"
+
+// struct _cl_compact is defined in .c file
+typedef struct _cl_compact *CListCompact;
+
+typedef void (*CL_compact_callback)(int64_t pos, CListElementType element, void *cb_data);
+
+
+/*
+ * Create a new, empty compact list
+ *
+ * Parameters: None
+ *
+ * Returns: The new list, which takes no memory for nodes or strings
+ *   until the first append
+ */
+CListCompact CL_compact_new();
+
+
+/*
+ * Destroy a compact list, releasing its pool and arena
+ *
+ * Parameters:
+ *   list   The list; if NULL, no action will occur
+ *
+ * Returns: None
+ */
+void CL_compact_free(CListCompact list);
+
+
+/*
+ * Create a new, empty compact list in a shared-memory segment. The
+ * segment is sized for the limits given and allocated in full up front,
+ * about 8 bytes per node plus the arena, so that running out of room on
+ * the shared-memory filesystem fails here rather than in a later write.
+ *
+ * Parameters:
+ *   name         The segment name, as for shm_open, e.g. "/my-list"
+ *   max_nodes    Most nodes the list will ever need; at least 1 and
+ *                less than 2^32
+ *   arena_bytes  Most string bytes it will ever need; at least 1 and at
+ *                most 2^32
+ *
+ * Returns: The new list, or NULL if a limit is out of range, the segment
+ *   already exists, or it could not be created or allocated
+ */
+CListCompact CL_compact_create_shared(const char *name, uint64_t max_nodes, uint64_t arena_bytes);
+
+
+/*
+ * Attach to a compact list created by CL_compact_create_shared, in this
+ * or another process. Changes made through any attachment are seen by
+ * all of them. Elements returned by the list point into the segment,
+ * and remain valid until this attachment is freed.
+ *
+ * Parameters:
+ *   name     The segment name
+ *
+ * Returns: The list, or NULL if no compact list segment has that name,
+ *   or if its creator has not yet finished setting it up
+ */
+CListCompact CL_compact_attach_shared(const char *name);
+
+
+/*
+ * Remove a shared list's name, as shm_unlink does. The segment itself
+ * is released once every attachment has been freed with
+ * CL_compact_free, which otherwise leaves the segment in place.
+ *
+ * Parameters:
+ *   name     The segment name
+ *
+ * Returns: true on success, false if there was no such segment
+ */
+bool CL_compact_unlink_shared(const char *name);
+
+
+/*
+ * Compute the length of a compact list
+ *
+ * Parameters:
+ *   list   The list
+ *
+ * Returns: The length of the list
+ */
+int64_t CL_compact_length(CListCompact list);
+
+
+/*
+ * Insert a copy of element onto the head of the list.
+ *
+ * Parameters:
+ *   list     The list
+ *   element  The element to insert
+ *
+ * Returns: true on success, false if the pool or arena is full
+ */
+bool CL_compact_push(CListCompact list, CListElementType element);
+
+
+/*
+ * Append a copy of element to the tail of the list, in O(1).
+ *
+ * Parameters:
+ *   list     The list
+ *   element  The element to append
+ *
+ * Returns: true on success, false if the pool or arena is full
+ */
+bool CL_compact_append(CListCompact list, CListElementType element);
+
+
+/*
+ * Remove the element from the head of the list and return it. The
+ * node is reused by later pushes and appends, but the string stays in
+ * the arena, so the returned element remains valid until the list is
+ * freed.
+ *
+ * Parameters:
+ *   list     The list
+ *
+ * Returns: The popped item, or INVALID_RETURN if the list is empty
+ */
+CListElementType CL_compact_pop(CListCompact list);
+
+
+/*
+ * Return the Nth element, without modifying the list. Positions are
+ * as for CL_nth.
+ *
+ * Parameters:
+ *   list     The list
+ *   pos      Position to return
+ *
+ * Returns: The requested element, or INVALID_RETURN if no element was found.
+ */
+CListElementType CL_compact_nth(CListCompact list, int64_t pos);
+
+
+/*
+ * Iterate through the list, as CL_foreach does. A shared list stays
+ * locked for reading throughout, so callback must not change it.
+ *
+ * Parameters:
+ *   list       The list
+ *   callback   The function to call
+ *   cb_data    Caller data to pass to the function
+ *
+ * Returns: None
+ */
+void CL_compact_foreach(CListCompact list, CL_compact_callback callback, void *cb_data);
+
+
+/*
+ * Append copies of all of a CList's elements to a compact list.
+ *
+ * Parameters:
+ *   list     The compact list
+ *   src      The list to copy
+ *
+ * Returns: true on success, false if the pool or arena filled up
+ */
+bool CL_compact_append_list(CListCompact list, CList src);
+
+
+/*
+ * Report how much of the pool and arena is in use
+ *
+ * Parameters:
+ *   list     The list
+ *
+ * Returns: The number of bytes used by nodes and strings
+ */
+size_t CL_compact_memory(CListCompact list);
+
+
+
+#endif /* _CLIST_COMPACT_H_ */
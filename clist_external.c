@@ -0,0 +1,446 @@
+/*
+ * clist_external.c
+ *
+ * External-memory sort: sorted runs spilled to disk, then a k-way merge
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "clist_external.h"
+
+
+// Memory charged for each record held in a run besides its bytes: a
+// CList node plus malloc overhead
+#define CLX_NODE_COST  32
+
+// Smallest read buffer worth giving a run during a merge; with more
+// runs than the budget allows at this size, they are merged in groups
+#define CLX_MIN_BUFFER  (64 << 10)
+
+// Buffer for writing a run file
+#define CLX_WRITE_BUFFER  (1 << 20)
+
+// A run being read during a merge
+struct _clx_cursor {
+  FILE *file;
+  char *buffer;                 // the stream's buffer
+  char *record;                 // the current record, NUL-terminated
+  size_t len, cap;
+};
+
+
+
+/*
+ * Create an unlinked temporary file in tmpdir for writing a run
+ *
+ * Parameters:
+ *   tmpdir   the directory
+ *   buffer   CLX_WRITE_BUFFER bytes to use as the stream's buffer
+ *
+ * Returns: The open stream, or NULL on failure
+ */
+static FILE *_CLX_new_run(const char *tmpdir, char *buffer)
+{
+  size_t size = strlen(tmpdir) + sizeof("/clist-sort-XXXXXX");
+  char *path = malloc(size);
+  assert(path);
+  snprintf(path, size, "%s/clist-sort-XXXXXX", tmpdir);
+
+  int fd = mkstemp(path);
+  if (fd >= 0)
+    unlink(path);
+  free(path);
+  if (fd < 0)
+    return NULL;
+
+  FILE *file = fdopen(fd, "w");
+  if (file == NULL) {
+    close(fd);
+    return NULL;
+  }
+  setvbuf(file, buffer, _IOFBF, CLX_WRITE_BUFFER);
+
+  return file;
+}
+
+
+
+/*
+ * Finish writing a run, closing its stream
+ *
+ * Returns: A descriptor for the run, positioned at its start, or -1
+ *   if the run could not be written
+ */
+static int _CLX_finish_run(FILE *file)
+{
+  int fd = -1;
+
+  if (fflush(file) == 0 && !ferror(file))
+    fd = dup(fileno(file));
+  if (fclose(file) != 0 && fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+  if (fd >= 0 && lseek(fd, 0, SEEK_SET) < 0) {
+    close(fd);
+    fd = -1;
+  }
+
+  return fd;
+}
+
+
+
+/*
+ * Write one record in run format: the length as a base-128 varint,
+ * low bits first, then the bytes
+ */
+static void _CLX_write_record(FILE *file, const char *record, size_t len)
+{
+  size_t n = len;
+
+  while (n >= 0x80) {
+    putc((n & 0x7f) | 0x80, file);
+    n >>= 7;
+  }
+  putc(n, file);
+  fwrite(record, 1, len, file);
+}
+
+
+
+/*
+ * Read the next record of a run into the cursor
+ *
+ * Returns: 1 if a record was read, 0 at the end of the run, -1 on error
+ */
+static int _CLX_read_record(struct _clx_cursor *cursor)
+{
+  size_t len = 0;
+  int shift = 0;
+  int c;
+
+  while ((c = getc(cursor->file)) != EOF) {
+    len |= (size_t) (c & 0x7f) << shift;
+    shift += 7;
+    if (!(c & 0x80))
+      break;
+  }
+  if (c == EOF)
+    return (shift == 0 && !ferror(cursor->file)) ? 0 : -1;
+
+  if (len + 1 > cursor->cap) {
+    cursor->cap = len + 1;
+    cursor->record = realloc(cursor->record, cursor->cap);
+    assert(cursor->record);
+  }
+  if (fread(cursor->record, 1, len, cursor->file) != len)
+    return -1;
+  cursor->record[len] = '\0';
+  cursor->len = len;
+
+  return 1;
+}
+
+
+
+// State for spilling a run with CL_foreach
+struct _clx_spill {
+  FILE *file;
+  char delimiter;
+  bool raw;                     // write delimited records, not run format
+};
+
+static void _CLX_spill_cb(int pos, CListElementType element, void *cb_data)
+{
+  struct _clx_spill *spill = cb_data;
+  size_t len = strlen(element);
+
+  if (spill->raw) {
+    fwrite(element, 1, len, spill->file);
+    putc(spill->delimiter, spill->file);
+  } else {
+    _CLX_write_record(spill->file, element, len);
+  }
+}
+
+
+
+/*
+ * Restore the heap property downwards from slot i
+ */
+static void _CLX_sift_down(struct _clx_cursor **heap, int n, int i)
+{
+  for (;;) {
+    int least = i;
+    int left = 2 * i + 1, right = 2 * i + 2;
+
+    if (left < n && strcmp(heap[left]->record, heap[least]->record) < 0)
+      least = left;
+    if (right < n && strcmp(heap[right]->record, heap[least]->record) < 0)
+      least = right;
+    if (least == i)
+      return;
+
+    struct _clx_cursor *tmp = heap[i];
+    heap[i] = heap[least];
+    heap[least] = tmp;
+    i = least;
+  }
+}
+
+
+
+/*
+ * Merge runs, closing their descriptors
+ *
+ * Parameters:
+ *   fds         the runs
+ *   nruns       how many there are
+ *   out         where to write the merged records
+ *   raw         true to write delimited records, false for run format
+ *   delimiter   the delimiter, if raw
+ *   buffer_size read buffer size for each run
+ *
+ * Returns: true on success, false on an I/O error
+ */
+static bool _CLX_merge(int *fds, int nruns, FILE *out, bool raw, char delimiter,
+                       size_t buffer_size)
+{
+  struct _clx_cursor *cursors = calloc(nruns, sizeof(struct _clx_cursor));
+  struct _clx_cursor **heap = malloc(nruns * sizeof(struct _clx_cursor *));
+  assert(cursors && heap);
+  bool ok = true;
+  int n = 0;
+
+  for (int i = 0; i < nruns; i++) {
+    struct _clx_cursor *cursor = &cursors[i];
+
+    posix_fadvise(fds[i], 0, 0, POSIX_FADV_SEQUENTIAL);
+    cursor->file = fdopen(fds[i], "r");
+    if (cursor->file == NULL) {
+      close(fds[i]);
+      ok = false;
+      continue;
+    }
+    cursor->buffer = malloc(buffer_size);
+    assert(cursor->buffer);
+    setvbuf(cursor->file, cursor->buffer, _IOFBF, buffer_size);
+
+    int got = _CLX_read_record(cursor);
+    if (got > 0)
+      heap[n++] = cursor;
+    else if (got < 0)
+      ok = false;
+  }
+
+  for (int i = n / 2 - 1; i >= 0; i--)
+    _CLX_sift_down(heap, n, i);
+
+  // Write the least record, then replace it with the next one from
+  // the same run
+  while (ok && n > 0) {
+    struct _clx_cursor *least = heap[0];
+
+    if (raw) {
+      fwrite(least->record, 1, least->len, out);
+      putc(delimiter, out);
+    } else {
+      _CLX_write_record(out, least->record, least->len);
+    }
+
+    int got = _CLX_read_record(least);
+    if (got < 0)
+      ok = false;
+    else if (got == 0)
+      heap[0] = heap[--n];
+    _CLX_sift_down(heap, n, 0);
+  }
+
+  for (int i = 0; i < nruns; i++) {
+    if (cursors[i].file != NULL)
+      fclose(cursors[i].file);
+    free(cursors[i].buffer);
+    free(cursors[i].record);
+  }
+  free(cursors);
+  free(heap);
+
+  return ok && !ferror(out);
+}
+
+
+
+// Documented in .h file
+bool CL_sort_external(FILE *in, FILE *out, char delimiter,
+                      const char *tmpdir, size_t mem_budget)
+{
+  assert(in);
+  assert(out);
+  assert(tmpdir);
+
+  if (mem_budget < CL_EXTERNAL_MIN_BUDGET)
+    mem_budget = CL_EXTERNAL_MIN_BUDGET;
+
+  // Run records are copied into the arena, and the run's CList holds
+  // pointers into it
+  size_t arena_cap = mem_budget;
+  char *arena = malloc(arena_cap);
+  char *write_buffer = malloc(CLX_WRITE_BUFFER);
+  assert(arena && write_buffer);
+  size_t arena_used = 0;
+  size_t charged = 0;           // arena_used plus node costs
+  CList run = CL_new();
+
+  int *fds = NULL;
+  int nruns = 0, fds_cap = 0;
+  bool ok = true;
+
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t got;
+
+  // Phase 1: read runs that fit in the budget, sort them, and spill
+  // all but the last to disk
+  for (;;) {
+    got = getdelim(&line, &line_cap, delimiter, in);
+    size_t len = (got > 0) ? got : 0;
+    if (len > 0 && line[len - 1] == delimiter)
+      len--;
+    size_t cost = len + 1 + CLX_NODE_COST;
+
+    if (charged > 0 && (got < 0 || charged + cost > mem_budget)) {
+      if (got < 0 && nruns == 0)
+        break;                  // everything fitted; no need to spill
+
+      FILE *file = _CLX_new_run(tmpdir, write_buffer);
+      if (file == NULL) {
+        ok = false;
+        break;
+      }
+      struct _clx_spill spill = { file, delimiter, false };
+      CL_sort(run);
+      CL_foreach(run, _CLX_spill_cb, &spill);
+
+      if (nruns == fds_cap) {
+        fds_cap = fds_cap ? 2 * fds_cap : 16;
+        fds = realloc(fds, fds_cap * sizeof(int));
+        assert(fds);
+      }
+      fds[nruns] = _CLX_finish_run(file);
+      if (fds[nruns] < 0) {
+        ok = false;
+        break;
+      }
+      nruns++;
+
+      while (CL_pop(run) != INVALID_RETURN)
+        ;
+      arena_used = charged = 0;
+    }
+
+    if (got < 0)
+      break;
+
+    if (len + 1 > arena_cap) {
+      // A single record larger than the budget; the run is empty here
+      arena_cap = len + 1;
+      arena = realloc(arena, arena_cap);
+      assert(arena);
+    }
+    memcpy(arena + arena_used, line, len);
+    arena[arena_used + len] = '\0';
+    CL_push(run, arena + arena_used);
+    arena_used += len + 1;
+    charged += cost;
+  }
+  if (ferror(in))
+    ok = false;
+  free(line);
+
+  if (ok && nruns == 0) {
+    // The whole input fitted in memory
+    struct _clx_spill spill = { out, delimiter, true };
+    CL_sort(run);
+    CL_foreach(run, _CLX_spill_cb, &spill);
+    ok = !ferror(out);
+  }
+  CL_free(run);
+  free(arena);
+
+  // Phase 2: merge runs in groups until each remaining run can have a
+  // buffer of at least CLX_MIN_BUFFER, then merge them into out
+  int fan_in = mem_budget / CLX_MIN_BUFFER - 1;
+  if (fan_in < 2)
+    fan_in = 2;
+
+  while (ok && nruns > fan_in) {
+    FILE *file = _CLX_new_run(tmpdir, write_buffer);
+    if (file == NULL) {
+      ok = false;
+      break;
+    }
+    ok = _CLX_merge(fds, fan_in, file, false, delimiter, mem_budget / (fan_in + 1));
+
+    // The merged runs are closed; the new one goes at the end
+    nruns -= fan_in;
+    memmove(fds, fds + fan_in, nruns * sizeof(int));
+    fds[nruns] = _CLX_finish_run(file);
+    if (fds[nruns] < 0)
+      ok = false;
+    else
+      nruns++;
+  }
+
+  if (ok && nruns > 0) {
+    ok = _CLX_merge(fds, nruns, out, true, delimiter, mem_budget / (nruns + 1));
+    nruns = 0;
+  }
+
+  // On failure, close whatever runs were not merged
+  for (int i = 0; i < nruns; i++)
+    close(fds[i]);
+  free(fds);
+  free(write_buffer);
+
+  return ok && fflush(out) == 0;
+}
+
+
+
+// Documented in .h file
+CList CL_sort_external_list(FILE *in, char delimiter,
+                            const char *tmpdir, size_t mem_budget)
+{
+  assert(in);
+  assert(tmpdir);
+
+  size_t size = strlen(tmpdir) + sizeof("/clist-sorted-XXXXXX");
+  char *path = malloc(size);
+  assert(path);
+  snprintf(path, size, "%s/clist-sorted-XXXXXX", tmpdir);
+
+  CList list = NULL;
+  int fd = mkstemp(path);
+  FILE *out = (fd >= 0) ? fdopen(fd, "w") : NULL;
+
+  if (out != NULL) {
+    bool ok = CL_sort_external(in, out, delimiter, tmpdir, mem_budget);
+    if (fclose(out) == 0 && ok)
+      list = CL_from_file(path, delimiter);
+  } else if (fd >= 0) {
+    close(fd);
+  }
+
+  // The list's mapping keeps the data after the name is gone
+  if (fd >= 0)
+    unlink(path);
+  free(path);
+
+  return list;
+}
@@ -0,0 +1,68 @@
+/*
+ * clist_external.h
+ *
+ * External-memory sort for string lists larger than RAM
+ *
+ * The input is read in runs that fit within a memory budget. Each run
+ * is sorted with CL_sort and spilled to an unlinked temporary file as
+ * a sequence of records, each a variable-length byte count followed by
+ * the string's bytes. The runs are then merged with a heap of k
+ * cursors, each reading through its own large buffer. If there are
+ * too many runs to give each one a useful buffer, groups of runs are
+ * first merged into longer runs.
+ *
+ * Records are delimited by a single character, as for CL_from_file,
+ * and are ordered by strcmp.
+ */
+
+#ifndef _CLIST_EXTERNAL_H_
+#define _CLIST_EXTERNAL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "clist.h"
+
+// Smallest memory budget that CL_sort_external will work within
+#define CL_EXTERNAL_MIN_BUDGET  (1 << 20)
+
+
+/*
+ * Sort the records of a stream into another stream
+ *
+ * Parameters:
+ *   in          The stream to read; records are separated by delimiter
+ *   out         The stream to write; each record is followed by delimiter
+ *   delimiter   The record separator, such as '\n'
+ *   tmpdir      Directory for temporary run files
+ *   mem_budget  Approximate memory to use, in bytes; raised to
+ *               CL_EXTERNAL_MIN_BUDGET if smaller. A single record
+ *               longer than the budget is still handled.
+ *
+ * Returns: true on success, false on an I/O error or if the temporary
+ *   files could not be created
+ */
+bool CL_sort_external(FILE *in, FILE *out, char delimiter,
+                      const char *tmpdir, size_t mem_budget);
+
+
+/*
+ * Sort the records of a stream into a new list. The sorted records are
+ * written to a temporary file in tmpdir, which the list then maps as
+ * CL_from_file does; the file is released by CL_free.
+ *
+ * Parameters:
+ *   in          The stream to read; records are separated by delimiter
+ *   delimiter   The record separator
+ *   tmpdir      Directory for temporary files
+ *   mem_budget  As for CL_sort_external
+ *
+ * Returns: The sorted list, or NULL on an I/O error
+ */
+CList CL_sort_external_list(FILE *in, char delimiter,
+                            const char *tmpdir, size_t mem_budget);
+
+
+
+#endif /* _CLIST_EXTERNAL_H_ */
@@ -0,0 +1,492 @@
+/*
+ * clist_fuzz.c
+ *
+ * Differential fuzz harness for CLists. A byte string is decoded into
+ * a sequence of CL_ operations, which are applied both to a CList and
+ * to a simple array-backed reference model; after every step the
+ * list's length and contents must match the model exactly.
+ *
+ * Built with -DCL_LIBFUZZER (and clang -fsanitize=fuzzer) this is a
+ * libFuzzer target. Otherwise main() generates random op sequences
+ * from a seed:
+ *
+ *   clist_fuzz [seed [runs [ops_per_run]]]
+ *
+ * Build with -DCL_BASE_API_ONLY to restrict the harness to the
+ * functions of the original assignment, so that other implementations
+ * of clist.h (such as Assignment5.c) can be checked too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "clist.h"
+
+
+// Elements are drawn from this pool. It is small so that there are
+// plenty of duplicates. Elements are compared by pointer, and the
+// strings are all distinct, so equal elements are identical pointers.
+static const char *pool[] = {"alpha", "bravo", "charlie", "delta", "echo",
+  "foxtrot", "golf", "hotel", "india", "juliet", "kilo", "lima", "mike",
+  "november", "oscar", "papa", "quebec", "romeo", "sierra", "tango",
+  "uniform", "victor", "whiskey", "xray", "yankee", "zulu", "", "a", "aa"};
+
+static const int pool_size = sizeof(pool) / sizeof(pool[0]);
+
+// Lists never grow beyond this, to bound the cost of checking
+#define MAX_LENGTH 100000
+#define MAX_BULK   8192
+
+
+// The reference model: a plain array
+typedef struct {
+  const char **v;
+  int n;
+  int cap;
+} Model;
+
+static void model_reserve(Model *m, int n)
+{
+  if (n > m->cap) {
+    m->cap = (n > 2 * m->cap) ? n : 2 * m->cap;
+    m->v = realloc(m->v, m->cap * sizeof(*m->v));
+  }
+}
+
+static void model_insert(Model *m, int pos, const char *e)
+{
+  model_reserve(m, m->n + 1);
+  memmove(&m->v[pos + 1], &m->v[pos], (m->n - pos) * sizeof(*m->v));
+  m->v[pos] = e;
+  m->n++;
+}
+
+static const char *model_remove(Model *m, int pos)
+{
+  const char *e = m->v[pos];
+  memmove(&m->v[pos], &m->v[pos + 1], (m->n - pos - 1) * sizeof(*m->v));
+  m->n--;
+  return e;
+}
+
+#ifndef CL_BASE_API_ONLY
+// A CL_predicate matching elements which start with *cb_data
+static bool first_char_is(CListElementType element, void *cb_data)
+{
+  return element[0] == *(const char *) cb_data;
+}
+
+static int cmp_strings(const void *a, const void *b)
+{
+  return strcmp(*(const char **) a, *(const char **) b);
+}
+
+// Merge a priority queue's pending insertions into the model the way
+// the list does: in ascending order, each before the first element not
+// less than it, searching on from the one inserted before
+static void model_settle(Model *m, Model *pending)
+{
+  qsort(pending->v, pending->n, sizeof(*pending->v), cmp_strings);
+
+  int at = 0;
+  for (int i = 0; i < pending->n; i++) {
+    while (at < m->n && strcmp(pending->v[i], m->v[at]) > 0)
+      at++;
+    model_insert(m, at++, pending->v[i]);
+  }
+  pending->n = 0;
+}
+#endif
+
+
+// Decodes the fuzz input; reads past the end return 0
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  size_t at;
+} Input;
+
+static unsigned next_byte(Input *in)
+{
+  return (in->at < in->size) ? in->data[in->at++] : 0;
+}
+
+static unsigned next_u16(Input *in)
+{
+  unsigned lo = next_byte(in);
+  return lo | (next_byte(in) << 8);
+}
+
+
+// Reports a mismatch and aborts, so that the fuzzer records the input
+#define check(cond, step, op) {                                         \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "MISMATCH at step %d (%s): %s\n", step, op, #cond); \
+      abort();                                                          \
+    }                                                                   \
+  }
+
+
+// State for comparing a list with a model through CL_foreach
+typedef struct {
+  const Model *m;
+  int expected_pos;
+  bool ok;
+} Compare;
+
+static void compare_cb(int pos, CListElementType element, void *cb_data)
+{
+  Compare *c = cb_data;
+
+  if (pos != c->expected_pos || pos >= c->m->n || c->m->v[pos] != element)
+    c->ok = false;
+  c->expected_pos++;
+}
+
+static bool matches(CList list, const Model *m)
+{
+  Compare c = { m, 0, true };
+
+  if (CL_length(list) != m->n)
+    return false;
+  CL_foreach(list, compare_cb, &c);
+
+  return c.ok && c.expected_pos == m->n;
+}
+
+
+// Map an argument onto a position, including some out of range ones
+static int pick_pos(unsigned arg, int n)
+{
+  return (int) (arg % (2 * n + 5)) - (n + 2);
+}
+
+
+enum {
+  OP_PUSH, OP_POP, OP_APPEND, OP_NTH, OP_INSERT, OP_REMOVE, OP_COPY,
+  OP_INSERT_SORTED, OP_JOIN, OP_REVERSE, OP_BULK,
+#ifndef CL_BASE_API_ONLY
+  OP_SORT, OP_SORT_PARALLEL, OP_COPY_PARALLEL, OP_DEDUP, OP_UNIQUE_SORTED,
+  OP_MERGE_SORTED, OP_REMOVE_IF, OP_PARTITION,
+#endif
+  NUM_OPS
+};
+
+static const char *op_names[] = {"push", "pop", "append", "nth", "insert",
+  "remove", "copy", "insert_sorted", "join", "reverse", "bulk", "sort",
+  "sort_parallel", "copy_parallel", "dedup", "unique_sorted", "merge_sorted", "remove_if", "partition"};
+
+
+/*
+ * Run one op sequence against a fresh list and model
+ *
+ * Parameters:
+ *   data, size   the encoded op sequence
+ *
+ * Returns: None; aborts on any mismatch
+ */
+static void run_ops(const uint8_t *data, size_t size)
+{
+  Input in = { data, size, 0 };
+  Model m = { NULL, 0, 0 };
+  CList list;
+
+  // A priority queue's insertions wait in pending until the next call
+  // other than CL_insert_sorted, CL_pop or CL_length merges them in
+  Model pending = { NULL, 0, 0 };
+  bool queue = false;
+
+  // The first byte picks how the list under test is created
+#ifndef CL_BASE_API_ONLY
+  CListStorage storage;
+  switch (next_byte(&in) % 4) {
+  case 0:  list = CL_new(); break;
+  case 1:  list = CL_init(&storage); break;
+  case 2:  list = CL_new_with_allocator(&CL_thread_cache_allocator); break;
+  default: list = CL_new_priority_queue(); queue = true; break;
+  }
+#else
+  next_byte(&in);
+  list = CL_new();
+#endif
+
+  for (int step = 0; in.at < in.size; step++) {
+    unsigned op = next_byte(&in) % NUM_OPS;
+    unsigned arg = next_u16(&in);
+    const char *e = pool[arg % pool_size];
+    const char *name = op_names[op];
+    bool full = m.n + pending.n >= MAX_LENGTH;
+
+#ifndef CL_BASE_API_ONLY
+    // Every op that reaches the list, other than these, settles it
+    if (pending.n > 0 && op != OP_POP && op != OP_INSERT_SORTED
+        && !(full && (op == OP_PUSH || op == OP_APPEND || op == OP_INSERT)))
+      model_settle(&m, &pending);
+#endif
+    int pos = pick_pos(arg, m.n);
+
+    switch (op) {
+    case OP_PUSH:
+      if (full)
+        break;
+      CL_push(list, e);
+      model_insert(&m, 0, e);
+      break;
+
+    case OP_POP: {
+      // A priority queue pops the least of its head and its pending
+      // insertions, preferring the latter on a tie
+      int least = -1;
+      for (int i = 0; i < pending.n; i++)
+        if (least < 0 || strcmp(pending.v[i], pending.v[least]) < 0)
+          least = i;
+      if (least >= 0 && (m.n == 0 || strcmp(pending.v[least], m.v[0]) <= 0))
+        check( CL_pop(list) == model_remove(&pending, least), step, name )
+      else
+        check( CL_pop(list) == (m.n ? model_remove(&m, 0) : INVALID_RETURN), step, name );
+      break;
+    }
+
+    case OP_APPEND:
+      if (full)
+        break;
+      CL_append(list, e);
+      model_insert(&m, m.n, e);
+      break;
+
+    case OP_NTH:
+      if (pos < -m.n || pos >= m.n)
+        check( CL_nth(list, pos) == INVALID_RETURN, step, name )
+      else
+        check( CL_nth(list, pos) == m.v[pos < 0 ? m.n + pos : pos], step, name );
+      break;
+
+    case OP_INSERT:
+      if (full)
+        break;
+      if (pos < -m.n - 1 || pos > m.n) {
+        check( !CL_insert(list, e, pos), step, name );
+      } else {
+        check( CL_insert(list, e, pos), step, name );
+        model_insert(&m, pos < 0 ? m.n + pos + 1 : pos, e);
+      }
+      break;
+
+    case OP_REMOVE:
+      if (pos < -m.n || pos >= m.n)
+        check( CL_remove(list, pos) == INVALID_RETURN, step, name )
+      else
+        check( CL_remove(list, pos) == model_remove(&m, pos < 0 ? m.n + pos : pos),
+               step, name );
+      break;
+
+    case OP_COPY: {
+      CList copy = CL_copy(list);
+      check( matches(copy, &m), step, name );
+      CL_free(copy);
+      break;
+    }
+
+    case OP_INSERT_SORTED: {
+      if (full)
+        break;
+      if (queue) {
+        check( CL_insert_sorted(list, e) == CL_NO_POSITION, step, name );
+        model_insert(&pending, pending.n, e);
+        break;
+      }
+      // Inserted before the first element that is not less than e,
+      // whether or not the list happens to be sorted
+      int expected = 0;
+      while (expected < m.n && strcmp(e, m.v[expected]) > 0)
+        expected++;
+      check( CL_insert_sorted(list, e) == expected, step, name );
+      model_insert(&m, expected, e);
+      break;
+    }
+
+    case OP_JOIN:
+    case OP_BULK: {
+      // Build a second list of up to arg elements, then join it on
+      int count = (op == OP_JOIN) ? (int) (arg % 16) : (int) (arg % MAX_BULK);
+      if (m.n + count > MAX_LENGTH)
+        count = MAX_LENGTH - m.n;
+      CList other = CL_new();
+      for (int i = count - 1; i >= 0; i--)
+        CL_push(other, pool[(arg + i) % pool_size]);
+      model_reserve(&m, m.n + count);
+      for (int i = 0; i < count; i++)
+        m.v[m.n++] = pool[(arg + i) % pool_size];
+      CL_join(list, other);
+      check( CL_length(other) == 0, step, name );
+      CL_free(other);
+      break;
+    }
+
+    case OP_REVERSE:
+      CL_reverse(list);
+      for (int i = 0; i < m.n / 2; i++) {
+        const char *tmp = m.v[i];
+        m.v[i] = m.v[m.n - 1 - i];
+        m.v[m.n - 1 - i] = tmp;
+      }
+      break;
+
+#ifndef CL_BASE_API_ONLY
+    case OP_SORT:
+    case OP_SORT_PARALLEL:
+      if (op == OP_SORT)
+        CL_sort(list);
+      else
+        CL_sort_parallel(list, 1 + arg % 8);
+      qsort(m.v, m.n, sizeof(*m.v), cmp_strings);
+      break;
+
+    case OP_COPY_PARALLEL: {
+      CList copy = CL_copy_parallel(list, 1 + arg % 8);
+      check( matches(copy, &m), step, name );
+      CL_free(copy);
+      break;
+    }
+
+    case OP_DEDUP:
+    case OP_UNIQUE_SORTED: {
+      // Keep an element unless an equal one was kept before it (dedup)
+      // or immediately before it (unique_sorted)
+      int kept = 0;
+      for (int i = 0; i < m.n; i++) {
+        bool dup = false;
+        if (op == OP_DEDUP) {
+          for (int j = 0; j < kept && !dup; j++)
+            dup = (strcmp(m.v[j], m.v[i]) == 0);
+        } else {
+          dup = (kept > 0 && strcmp(m.v[kept - 1], m.v[i]) == 0);
+        }
+        if (!dup)
+          m.v[kept++] = m.v[i];
+      }
+      int removed = (op == OP_DEDUP) ? CL_dedup(list) : CL_unique_sorted(list);
+      check( removed == m.n - kept, step, name );
+      m.n = kept;
+      break;
+    }
+
+    case OP_MERGE_SORTED: {
+      // Sort the list, then merge in a sorted list of up to 16 elements
+      CL_sort(list);
+      qsort(m.v, m.n, sizeof(*m.v), cmp_strings);
+      int count = arg % 16;
+      if (m.n + count > MAX_LENGTH)
+        count = MAX_LENGTH - m.n;
+      CList other = CL_new();
+      for (int i = 0; i < count; i++) {
+        const char *x = pool[(arg + 7 * i) % pool_size];
+        CL_insert_sorted(other, x);
+        int at = 0;
+        while (at < m.n && strcmp(x, m.v[at]) > 0)
+          at++;
+        model_insert(&m, at, x);
+      }
+      CL_merge_sorted(list, other);
+      check( CL_length(other) == 0, step, name );
+      CL_free(other);
+      break;
+    }
+
+    case OP_REMOVE_IF:
+    case OP_PARTITION: {
+      // Matching elements are dropped, or moved in order to other
+      char c = e[0];
+      Model moved = { NULL, 0, 0 };
+      int kept = 0;
+      for (int i = 0; i < m.n; i++) {
+        if (m.v[i][0] == c)
+          model_insert(&moved, moved.n, m.v[i]);
+        else
+          m.v[kept++] = m.v[i];
+      }
+      m.n = kept;
+
+      if (op == OP_REMOVE_IF) {
+        check( CL_remove_if(list, first_char_is, &c) == moved.n, step, name );
+      } else {
+        CList other = CL_new();
+        check( CL_partition(list, first_char_is, &c, other) == moved.n, step, name );
+        check( matches(other, &moved), step, name );
+        CL_free(other);
+      }
+      free(moved.v);
+      break;
+    }
+#endif // CL_BASE_API_ONLY
+    }
+
+    // Comparing contents would settle a priority queue, so while it
+    // has insertions pending only its length is checked
+    if (pending.n > 0)
+      check( CL_length(list) == m.n + pending.n, step, name )
+    else
+      check( matches(list, &m), step, name );
+  }
+
+  CL_free(list);
+  free(m.v);
+  free(pending.v);
+#ifndef CL_BASE_API_ONLY
+  CL_thread_cache_flush();
+#endif
+}
+
+
+#ifdef CL_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  run_ops(data, size);
+  return 0;
+}
+
+#else
+
+int main(int argc, char *argv[])
+{
+  unsigned seed = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1;
+  int runs = (argc > 2) ? atoi(argv[2]) : 100;
+  int ops = (argc > 3) ? atoi(argv[3]) : 300;
+
+  uint8_t *data = malloc(1 + 3 * ops);
+
+  for (int run = 0; run < runs; run++) {
+    srand(seed + run);
+
+    // Make bulk ops rare in most runs, so that both short lists and
+    // (every eighth run) long lists get a good workout
+    int bulk_odds = (run % 8 == 7) ? 4 : 64;
+
+    data[0] = rand();
+    for (int i = 0; i < ops; i++) {
+      uint8_t *op = &data[1 + 3 * i];
+      op[0] = rand() % NUM_OPS;
+      if (op[0] == OP_BULK && rand() % bulk_odds != 0)
+        op[0] = OP_APPEND;
+#ifndef CL_BASE_API_ONLY
+      // Ops that can shrink the list drastically are rare too
+      if ((op[0] == OP_DEDUP || op[0] == OP_UNIQUE_SORTED
+           || op[0] == OP_REMOVE_IF || op[0] == OP_PARTITION) && rand() % 16 != 0)
+        op[0] = OP_NTH;
+#endif
+      op[1] = rand();
+      op[2] = rand();
+    }
+
+    run_ops(data, 1 + 3 * ops);
+  }
+
+  printf("Passed %d runs of %d ops (seed %u)\n", runs, ops, seed);
+  free(data);
+  return 0;
+}
+
+#endif // CL_LIBFUZZER
@@ -0,0 +1,986 @@
+/*
+ * clist_journal.c
+ *
+ * Write-ahead journal for CList mutations: log records, group commit,
+ * recovery and checkpoints
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "clist_journal.h"
+
+
+// File headers: a magic number, then the generation as 8 bytes. The
+// log's generation must match the snapshot's for it to be replayed.
+#define CLJ_LOG_MAGIC   "CLJ1"
+#define CLJ_SNAP_MAGIC  "CLS1"
+#define CLJ_HEADER_SIZE 12
+
+// With CL_JOURNAL_NO_SYNC, buffered records are written once there
+// are this many bytes of them
+#define CLJ_NO_SYNC_FLUSH  (64 << 10)
+
+// Size of the blocks that hold the journal's copies of elements
+#define CLJ_CHUNK_SIZE  (64 << 10)
+
+// Log record types. Each record is framed as a varint payload length,
+// the payload (the type byte, then its arguments), and the CRC-32 of
+// the payload. Strings are a varint length followed by the bytes, and
+// positions are zigzag-encoded varints.
+enum {
+  CLJ_PUSH = 1,         // string
+  CLJ_APPEND,           // string
+  CLJ_INSERT,           // position, string
+  CLJ_REMOVE,           // position
+  CLJ_POP,
+  CLJ_JOIN,             // count, then that many strings
+  CLJ_REVERSE,
+};
+
+// A growable byte buffer
+struct _clj_buffer {
+  unsigned char *data;
+  size_t len, cap;
+};
+
+// A block of element copies
+struct _clj_chunk {
+  struct _clj_chunk *next;
+  size_t used, size;
+  char data[];
+};
+
+struct _cl_journal {
+  CList list;
+  struct _clj_chunk *chunks;    // storage for the list's elements
+  char *path, *snap_path;
+  int fd;                       // the log, opened for appending
+  uint64_t generation;
+  int sync_ms;
+  bool failed;                  // a write or fsync has failed
+
+  struct _clj_buffer record;    // the record being built
+  struct _clj_buffer pending;   // records not yet handed to the log
+  struct _clj_buffer writing;   // records being written to the log
+
+  // lock protects the list, chunks, record and pending. io_lock
+  // protects fd and writing, and is always taken before lock.
+  pthread_mutex_t lock;
+  pthread_mutex_t io_lock;
+
+  // Group commit thread, when sync_ms > 0
+  pthread_t flusher;
+  pthread_cond_t wakeup;
+  bool stopping;
+};
+
+
+
+/*
+ * CRC-32 (IEEE 802.3), as used by zlib
+ */
+static uint32_t _CLJ_crc_table[256];
+static pthread_once_t _CLJ_crc_once = PTHREAD_ONCE_INIT;
+
+static void _CLJ_crc_init(void)
+{
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++)
+      c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    _CLJ_crc_table[i] = c;
+  }
+}
+
+static uint32_t _CLJ_crc32(const unsigned char *data, size_t len)
+{
+  uint32_t c = 0xffffffff;
+
+  for (size_t i = 0; i < len; i++)
+    c = _CLJ_crc_table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+
+  return c ^ 0xffffffff;
+}
+
+
+
+/*
+ * Buffer helpers
+ */
+static void _CLJ_put(struct _clj_buffer *buf, const void *data, size_t len)
+{
+  if (buf->len + len > buf->cap) {
+    buf->cap = (buf->cap == 0) ? 256 : buf->cap;
+    while (buf->len + len > buf->cap)
+      buf->cap *= 2;
+    buf->data = realloc(buf->data, buf->cap);
+    assert(buf->data);
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+}
+
+static void _CLJ_put_varint(struct _clj_buffer *buf, uint64_t n)
+{
+  unsigned char bytes[10];
+  int len = 0;
+
+  while (n >= 0x80) {
+    bytes[len++] = (n & 0x7f) | 0x80;
+    n >>= 7;
+  }
+  bytes[len++] = n;
+  _CLJ_put(buf, bytes, len);
+}
+
+static void _CLJ_put_string(struct _clj_buffer *buf, const char *str)
+{
+  size_t len = strlen(str);
+
+  _CLJ_put_varint(buf, len);
+  _CLJ_put(buf, str, len);
+}
+
+static void _CLJ_put_pos(struct _clj_buffer *buf, int pos)
+{
+  _CLJ_put_varint(buf, ((uint64_t) (int64_t) pos << 1) ^ (uint64_t) ((int64_t) pos >> 63));
+}
+
+// Header of a log or snapshot file
+static void _CLJ_put_header(struct _clj_buffer *buf, const char *magic, uint64_t generation)
+{
+  _CLJ_put(buf, magic, 4);
+  _CLJ_put(buf, &generation, sizeof(generation));
+}
+
+
+
+/*
+ * Reading from a buffer; each returns false if the data runs out
+ */
+struct _clj_reader {
+  const unsigned char *data;
+  size_t len, pos;
+};
+
+static bool _CLJ_get_varint(struct _clj_reader *r, uint64_t *n)
+{
+  *n = 0;
+  for (int shift = 0; shift < 64 && r->pos < r->len; shift += 7) {
+    unsigned char c = r->data[r->pos++];
+    *n |= (uint64_t) (c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return true;
+  }
+
+  return false;
+}
+
+static bool _CLJ_get_pos(struct _clj_reader *r, int *pos)
+{
+  uint64_t n;
+
+  if (!_CLJ_get_varint(r, &n))
+    return false;
+  *pos = (int) ((n >> 1) ^ -(n & 1));
+
+  return true;
+}
+
+static bool _CLJ_get_string(struct _clj_reader *r, const char **str, size_t *len)
+{
+  uint64_t n;
+
+  if (!_CLJ_get_varint(r, &n) || n > r->len - r->pos)
+    return false;
+  *str = (const char *) r->data + r->pos;
+  *len = n;
+  r->pos += n;
+
+  return true;
+}
+
+
+
+/*
+ * Copy a string of len bytes into the journal's element storage
+ *
+ * Returns: The NUL-terminated copy
+ */
+static char *_CLJ_copy(struct _clj_chunk **chunks, const char *str, size_t len)
+{
+  struct _clj_chunk *chunk = *chunks;
+
+  if (chunk == NULL || chunk->used + len + 1 > chunk->size) {
+    size_t size = (len + 1 > CLJ_CHUNK_SIZE) ? len + 1 : CLJ_CHUNK_SIZE;
+    chunk = malloc(sizeof(struct _clj_chunk) + size);
+    assert(chunk);
+    chunk->next = *chunks;
+    chunk->used = 0;
+    chunk->size = size;
+    *chunks = chunk;
+  }
+
+  char *copy = chunk->data + chunk->used;
+  memcpy(copy, str, len);
+  copy[len] = '\0';
+  chunk->used += len + 1;
+
+  return copy;
+}
+
+/*
+ * Check pos as CL_insert does, so that an element is only copied into
+ * the journal's storage for an insertion that will succeed
+ */
+static bool _CLJ_insert_pos_ok(CList list, int64_t pos)
+{
+  int64_t length = CL_length64(list);
+
+  return pos >= -length - 1 && pos <= length;
+}
+
+
+
+static void _CLJ_free_chunks(struct _clj_chunk *chunk)
+{
+  while (chunk != NULL) {
+    struct _clj_chunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+}
+
+
+
+/*
+ * Read a whole file into memory
+ *
+ * Returns: true on success, with *data (to be freed) and *len set
+ */
+static bool _CLJ_read_file(int fd, unsigned char **data, size_t *len)
+{
+  struct stat st;
+
+  if (fstat(fd, &st) < 0)
+    return false;
+
+  *len = st.st_size;
+  *data = malloc(*len + 1);
+  assert(*data);
+
+  size_t done = 0;
+  while (done < *len) {
+    ssize_t n = pread(fd, *data + done, *len - done, done);
+    if (n <= 0) {
+      free(*data);
+      return false;
+    }
+    done += n;
+  }
+
+  return true;
+}
+
+
+
+/*
+ * Write all of a buffer to fd
+ */
+static bool _CLJ_write_all(int fd, const unsigned char *data, size_t len)
+{
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    len -= n;
+  }
+
+  return true;
+}
+
+
+
+/*
+ * Write the pending records to the log, and fsync it if asked
+ *
+ * Returns: true unless this or an earlier write has failed
+ */
+static bool _CLJ_flush(CListJournal journal, bool sync)
+{
+  pthread_mutex_lock(&journal->io_lock);
+
+  // Taking the whole pending buffer keeps records in order even when
+  // several threads flush
+  pthread_mutex_lock(&journal->lock);
+  struct _clj_buffer tmp = journal->writing;
+  journal->writing = journal->pending;
+  journal->pending = tmp;
+  pthread_mutex_unlock(&journal->lock);
+
+  bool ok = _CLJ_write_all(journal->fd, journal->writing.data, journal->writing.len);
+  journal->writing.len = 0;
+  if (ok && sync)
+    ok = fdatasync(journal->fd) == 0;
+
+  pthread_mutex_lock(&journal->lock);
+  if (!ok)
+    journal->failed = true;
+  ok = !journal->failed;
+  pthread_mutex_unlock(&journal->lock);
+
+  pthread_mutex_unlock(&journal->io_lock);
+
+  return ok;
+}
+
+
+
+/*
+ * Group commit: flush and fsync every sync_ms milliseconds until the
+ * journal is closed
+ */
+static void *_CLJ_flusher_thread(void *arg)
+{
+  CListJournal journal = arg;
+
+  pthread_mutex_lock(&journal->lock);
+  while (!journal->stopping) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += journal->sync_ms / 1000;
+    deadline.tv_nsec += (journal->sync_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&journal->wakeup, &journal->lock, &deadline);
+
+    if (journal->pending.len > 0) {
+      pthread_mutex_unlock(&journal->lock);
+      _CLJ_flush(journal, true);
+      pthread_mutex_lock(&journal->lock);
+    }
+  }
+  pthread_mutex_unlock(&journal->lock);
+
+  return NULL;
+}
+
+
+
+/*
+ * Start building a record of the given type in journal->record
+ */
+static void _CLJ_begin(CListJournal journal, unsigned char type)
+{
+  _CLJ_put(&journal->record, &type, 1);
+}
+
+
+
+/*
+ * Frame the record that has been built in journal->record and add it
+ * to the pending records. Called with journal->lock held.
+ *
+ * Returns: true if the caller should flush now, after unlocking
+ */
+static bool _CLJ_log(CListJournal journal)
+{
+  struct _clj_buffer *record = &journal->record;
+  uint32_t crc = _CLJ_crc32(record->data, record->len);
+
+  _CLJ_put_varint(&journal->pending, record->len);
+  _CLJ_put(&journal->pending, record->data, record->len);
+  _CLJ_put(&journal->pending, &crc, sizeof(crc));
+  record->len = 0;
+
+  return journal->sync_ms == 0
+    || (journal->sync_ms < 0 && journal->pending.len >= CLJ_NO_SYNC_FLUSH);
+}
+
+
+
+/*
+ * Finish a mutation: unlock, then flush if _CLJ_log asked for it
+ */
+static void _CLJ_done(CListJournal journal, bool flush)
+{
+  pthread_mutex_unlock(&journal->lock);
+
+  if (flush)
+    _CLJ_flush(journal, journal->sync_ms == 0);
+}
+
+
+
+/*
+ * Apply one log record to the list
+ *
+ * Returns: true on success, false if the record is malformed
+ */
+static bool _CLJ_replay_record(CListJournal journal, struct _clj_reader *r)
+{
+  CList list = journal->list;
+  const char *str;
+  size_t len;
+  uint64_t count;
+  int pos;
+
+  if (r->pos >= r->len)
+    return false;
+
+  switch (r->data[r->pos++]) {
+  case CLJ_PUSH:
+    if (!_CLJ_get_string(r, &str, &len))
+      return false;
+    CL_push(list, _CLJ_copy(&journal->chunks, str, len));
+    break;
+
+  case CLJ_APPEND:
+    if (!_CLJ_get_string(r, &str, &len))
+      return false;
+    CL_append(list, _CLJ_copy(&journal->chunks, str, len));
+    break;
+
+  case CLJ_INSERT:
+    if (!_CLJ_get_pos(r, &pos) || !_CLJ_get_string(r, &str, &len))
+      return false;
+    if (!_CLJ_insert_pos_ok(list, pos))
+      return false;
+    return CL_insert(list, _CLJ_copy(&journal->chunks, str, len), pos);
+
+  case CLJ_REMOVE:
+    if (!_CLJ_get_pos(r, &pos))
+      return false;
+    return CL_remove(list, pos) != INVALID_RETURN;
+
+  case CLJ_POP:
+    return CL_pop(list) != INVALID_RETURN;
+
+  case CLJ_JOIN: {
+    if (!_CLJ_get_varint(r, &count))
+      return false;
+    CList other = CL_new();
+    for (uint64_t i = 0; i < count; i++) {
+      if (!_CLJ_get_string(r, &str, &len)) {
+        CL_free(other);
+        return false;
+      }
+      CL_push(other, _CLJ_copy(&journal->chunks, str, len));
+    }
+    CL_reverse(other);
+    CL_join(list, other);
+    CL_free(other);
+    break;
+  }
+
+  case CLJ_REVERSE:
+    CL_reverse(list);
+    break;
+
+  default:
+    return false;
+  }
+
+  return true;
+}
+
+
+
+/*
+ * Load the snapshot, if there is one, into journal->list
+ *
+ * Returns: true on success, false if the snapshot is unreadable
+ */
+static bool _CLJ_load_snapshot(CListJournal journal)
+{
+  int fd = open(journal->snap_path, O_RDONLY);
+  if (fd < 0)
+    return errno == ENOENT;
+
+  unsigned char *data;
+  size_t len;
+  bool ok = _CLJ_read_file(fd, &data, &len);
+  close(fd);
+  if (!ok)
+    return false;
+
+  // Header, count, strings, then the CRC-32 of everything before it
+  struct _clj_reader r = { data, len, CLJ_HEADER_SIZE };
+  uint64_t count;
+  uint32_t crc;
+
+  ok = len >= CLJ_HEADER_SIZE + sizeof(crc)
+    && memcmp(data, CLJ_SNAP_MAGIC, 4) == 0;
+  if (ok) {
+    memcpy(&crc, data + len - sizeof(crc), sizeof(crc));
+    r.len -= sizeof(crc);
+    ok = crc == _CLJ_crc32(data, r.len);
+  }
+  if (ok) {
+    memcpy(&journal->generation, data + 4, sizeof(journal->generation));
+    ok = _CLJ_get_varint(&r, &count);
+  }
+
+  // Elements are pushed and then reversed, to avoid O(n) appends
+  for (uint64_t i = 0; ok && i < count; i++) {
+    const char *str;
+    size_t slen;
+    ok = _CLJ_get_string(&r, &str, &slen);
+    if (ok)
+      CL_push(journal->list, _CLJ_copy(&journal->chunks, str, slen));
+  }
+  CL_reverse(journal->list);
+
+  free(data);
+  return ok;
+}
+
+
+
+/*
+ * Start a new, empty log for the current generation
+ */
+static bool _CLJ_reset_log(CListJournal journal)
+{
+  struct _clj_buffer header = { NULL, 0, 0 };
+  _CLJ_put_header(&header, CLJ_LOG_MAGIC, journal->generation);
+
+  bool ok = ftruncate(journal->fd, 0) == 0
+    && _CLJ_write_all(journal->fd, header.data, header.len)
+    && fdatasync(journal->fd) == 0;
+
+  free(header.data);
+  return ok;
+}
+
+
+
+/*
+ * Replay the log on top of the snapshot. A log from an older
+ * generation was already folded into the snapshot, and is discarded.
+ * A torn or corrupt record ends the log, which is truncated there.
+ *
+ * Returns: true on success, false if the log is unusable
+ */
+static bool _CLJ_replay_log(CListJournal journal)
+{
+  unsigned char *data;
+  size_t len;
+
+  if (!_CLJ_read_file(journal->fd, &data, &len))
+    return false;
+
+  uint64_t generation = 0;
+  if (len >= CLJ_HEADER_SIZE)
+    memcpy(&generation, data + 4, sizeof(generation));
+
+  bool ok;
+  if (len < CLJ_HEADER_SIZE) {
+    ok = _CLJ_reset_log(journal);         // new, or torn while being reset
+  } else if (memcmp(data, CLJ_LOG_MAGIC, 4) != 0) {
+    ok = false;                           // not a log
+  } else if (generation < journal->generation) {
+    ok = _CLJ_reset_log(journal);
+  } else if (generation > journal->generation) {
+    ok = false;                           // newer than the snapshot
+  } else {
+    struct _clj_reader r = { data, len, CLJ_HEADER_SIZE };
+    size_t good = r.pos;
+
+    for (;;) {
+      uint64_t payload;
+      uint32_t crc;
+      if (!_CLJ_get_varint(&r, &payload) || payload > r.len - r.pos
+          || r.len - r.pos - payload < sizeof(crc))
+        break;
+      memcpy(&crc, r.data + r.pos + payload, sizeof(crc));
+      if (crc != _CLJ_crc32(r.data + r.pos, payload))
+        break;
+
+      struct _clj_reader record = { r.data + r.pos, payload, 0 };
+      if (!_CLJ_replay_record(journal, &record))
+        break;
+      r.pos += payload + sizeof(crc);
+      good = r.pos;
+    }
+
+    ok = (good == len) || ftruncate(journal->fd, good) == 0;
+  }
+
+  free(data);
+  return ok;
+}
+
+
+
+// Documented in .h file
+CListJournal CL_journal_open(const char *path, int sync_ms)
+{
+  assert(path);
+
+  pthread_once(&_CLJ_crc_once, _CLJ_crc_init);
+
+  CListJournal journal = calloc(1, sizeof(struct _cl_journal));
+  assert(journal);
+  journal->list = CL_new();
+  journal->sync_ms = sync_ms;
+  journal->path = strdup(path);
+  journal->snap_path = malloc(strlen(path) + sizeof(".snap"));
+  assert(journal->path && journal->snap_path);
+  sprintf(journal->snap_path, "%s.snap", path);
+  pthread_mutex_init(&journal->lock, NULL);
+  pthread_mutex_init(&journal->io_lock, NULL);
+  pthread_cond_init(&journal->wakeup, NULL);
+
+  journal->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (journal->fd < 0 || !_CLJ_load_snapshot(journal) || !_CLJ_replay_log(journal)) {
+    journal->sync_ms = CL_JOURNAL_NO_SYNC;    // no flusher to stop
+    CL_journal_close(journal);
+    return NULL;
+  }
+
+  if (sync_ms > 0)
+    pthread_create(&journal->flusher, NULL, _CLJ_flusher_thread, journal);
+
+  return journal;
+}
+
+
+
+// Documented in .h file
+CList CL_journal_list(CListJournal journal)
+{
+  assert(journal);
+
+  return journal->list;
+}
+
+
+
+// Documented in .h file
+void CL_journal_foreach(CListJournal journal, CL_foreach64_callback callback, void *cb_data)
+{
+  assert(journal);
+  assert(callback);
+
+  pthread_mutex_lock(&journal->lock);
+  CL_foreach64(journal->list, callback, cb_data);
+  pthread_mutex_unlock(&journal->lock);
+}
+
+
+
+// Documented in .h file
+void CL_journal_push(CListJournal journal, CListElementType element)
+{
+  assert(journal);
+  assert(element);
+
+  pthread_mutex_lock(&journal->lock);
+  CL_push(journal->list, _CLJ_copy(&journal->chunks, element, strlen(element)));
+
+  _CLJ_begin(journal, CLJ_PUSH);
+  _CLJ_put_string(&journal->record, element);
+  _CLJ_done(journal, _CLJ_log(journal));
+}
+
+
+
+// Documented in .h file
+void CL_journal_append(CListJournal journal, CListElementType element)
+{
+  assert(journal);
+  assert(element);
+
+  pthread_mutex_lock(&journal->lock);
+  CL_append(journal->list, _CLJ_copy(&journal->chunks, element, strlen(element)));
+
+  _CLJ_begin(journal, CLJ_APPEND);
+  _CLJ_put_string(&journal->record, element);
+  _CLJ_done(journal, _CLJ_log(journal));
+}
+
+
+
+// Documented in .h file
+bool CL_journal_insert(CListJournal journal, CListElementType element, int pos)
+{
+  assert(journal);
+  assert(element);
+
+  pthread_mutex_lock(&journal->lock);
+  if (!_CLJ_insert_pos_ok(journal->list, pos)) {
+    _CLJ_done(journal, false);
+    return false;
+  }
+  CL_insert(journal->list, _CLJ_copy(&journal->chunks, element, strlen(element)), pos);
+
+  _CLJ_begin(journal, CLJ_INSERT);
+  _CLJ_put_pos(&journal->record, pos);
+  _CLJ_put_string(&journal->record, element);
+  _CLJ_done(journal, _CLJ_log(journal));
+
+  return true;
+}
+
+
+
+// Documented in .h file
+CListElementType CL_journal_remove(CListJournal journal, int pos)
+{
+  assert(journal);
+
+  pthread_mutex_lock(&journal->lock);
+  CListElementType element = CL_remove(journal->list, pos);
+  if (element == INVALID_RETURN) {
+    _CLJ_done(journal, false);
+    return INVALID_RETURN;
+  }
+
+  _CLJ_begin(journal, CLJ_REMOVE);
+  _CLJ_put_pos(&journal->record, pos);
+  _CLJ_done(journal, _CLJ_log(journal));
+
+  return element;
+}
+
+
+
+// Documented in .h file
+CListElementType CL_journal_pop(CListJournal journal)
+{
+  assert(journal);
+
+  pthread_mutex_lock(&journal->lock);
+  CListElementType element = CL_pop(journal->list);
+  if (element == INVALID_RETURN) {
+    _CLJ_done(journal, false);
+    return INVALID_RETURN;
+  }
+
+  _CLJ_begin(journal, CLJ_POP);
+  _CLJ_done(journal, _CLJ_log(journal));
+
+  return element;
+}
+
+
+
+// Documented in .h file
+void CL_journal_reverse(CListJournal journal)
+{
+  assert(journal);
+
+  pthread_mutex_lock(&journal->lock);
+  CL_reverse(journal->list);
+
+  _CLJ_begin(journal, CLJ_REVERSE);
+  _CLJ_done(journal, _CLJ_log(journal));
+}
+
+
+
+// Documented in .h file
+void CL_journal_join(CListJournal journal, CList list)
+{
+  assert(journal);
+  assert(list);
+
+  pthread_mutex_lock(&journal->lock);
+
+  // Move list's elements into a list of copies, logging each
+  CList copies = CL_new();
+  uint64_t count = 0;
+  struct _clj_buffer strings = { NULL, 0, 0 };
+  CListElementType element;
+  while ((element = CL_pop(list)) != INVALID_RETURN) {
+    CL_push(copies, _CLJ_copy(&journal->chunks, element, strlen(element)));
+    _CLJ_put_string(&strings, element);
+    count++;
+  }
+
+  if (count == 0) {
+    CL_free(copies);
+    _CLJ_done(journal, false);
+    return;
+  }
+
+  CL_reverse(copies);
+  CL_join(journal->list, copies);
+  CL_free(copies);
+
+  _CLJ_begin(journal, CLJ_JOIN);
+  _CLJ_put_varint(&journal->record, count);
+  _CLJ_put(&journal->record, strings.data, strings.len);
+  free(strings.data);
+  _CLJ_done(journal, _CLJ_log(journal));
+}
+
+
+
+// Documented in .h file
+bool CL_journal_sync(CListJournal journal)
+{
+  assert(journal);
+
+  return _CLJ_flush(journal, true);
+}
+
+
+
+// State for writing a snapshot with CL_foreach
+struct _clj_snapshot {
+  struct _clj_buffer *buf;
+  CList list;                   // the list of fresh copies
+  struct _clj_chunk **chunks;
+};
+
+static void _CLJ_snapshot_cb(int64_t pos, CListElementType element, void *cb_data)
+{
+  struct _clj_snapshot *snap = cb_data;
+
+  _CLJ_put_string(snap->buf, element);
+  CL_push(snap->list, _CLJ_copy(snap->chunks, element, strlen(element)));
+}
+
+
+
+/*
+ * fsync the directory containing path, so that a rename in it is
+ * durable
+ */
+static bool _CLJ_sync_dir(const char *path)
+{
+  char *copy = strdup(path);
+  assert(copy);
+  int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+  free(copy);
+  if (fd < 0)
+    return false;
+
+  bool ok = fsync(fd) == 0;
+  close(fd);
+
+  return ok;
+}
+
+
+
+// Documented in .h file
+bool CL_journal_checkpoint(CListJournal journal)
+{
+  assert(journal);
+
+  pthread_mutex_lock(&journal->io_lock);
+  pthread_mutex_lock(&journal->lock);
+
+  // Serialize the list, copying its elements into fresh storage so
+  // that elements dropped since the last checkpoint are released
+  struct _clj_buffer buf = { NULL, 0, 0 };
+  struct _clj_chunk *chunks = NULL;
+  CList list = CL_new();
+  struct _clj_snapshot snap = { &buf, list, &chunks };
+
+  _CLJ_put_header(&buf, CLJ_SNAP_MAGIC, journal->generation + 1);
+  _CLJ_put_varint(&buf, CL_length64(journal->list));
+  CL_foreach64(journal->list, _CLJ_snapshot_cb, &snap);
+  CL_reverse(list);
+  uint32_t crc = _CLJ_crc32(buf.data, buf.len);
+  _CLJ_put(&buf, &crc, sizeof(crc));
+
+  // Write the snapshot beside the old one, then rename it into place
+  char *tmp_path = malloc(strlen(journal->snap_path) + sizeof(".tmp"));
+  assert(tmp_path);
+  sprintf(tmp_path, "%s.tmp", journal->snap_path);
+
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool ok = fd >= 0 && _CLJ_write_all(fd, buf.data, buf.len) && fsync(fd) == 0;
+  if (fd >= 0)
+    close(fd);
+  ok = ok && rename(tmp_path, journal->snap_path) == 0 && _CLJ_sync_dir(journal->snap_path);
+  if (!ok)
+    unlink(tmp_path);
+  free(tmp_path);
+  free(buf.data);
+
+  if (ok) {
+    // The snapshot now holds every pending record as well. Until the
+    // log is reset below, recovery discards it as an older generation.
+    journal->generation++;
+    journal->pending.len = 0;
+    ok = _CLJ_reset_log(journal);
+    if (!ok)
+      journal->failed = true;
+
+    // Swap the copies in under the same CList, which callers of
+    // CL_journal_list may be holding on to
+    CList old = CL_new();
+    CL_join(old, journal->list);
+    CL_join(journal->list, list);
+    CL_free(old);
+    CL_free(list);
+    _CLJ_free_chunks(journal->chunks);
+    journal->chunks = chunks;
+  } else {
+    CL_free(list);
+    _CLJ_free_chunks(chunks);
+  }
+
+  pthread_mutex_unlock(&journal->lock);
+  pthread_mutex_unlock(&journal->io_lock);
+
+  return ok;
+}
+
+
+
+// Documented in .h file
+bool CL_journal_close(CListJournal journal)
+{
+  if (journal == NULL)
+    return true;
+
+  if (journal->sync_ms > 0) {
+    pthread_mutex_lock(&journal->lock);
+    journal->stopping = true;
+    pthread_cond_signal(&journal->wakeup);
+    pthread_mutex_unlock(&journal->lock);
+    pthread_join(journal->flusher, NULL);
+  }
+
+  bool ok = true;
+  if (journal->fd >= 0) {
+    ok = _CLJ_flush(journal, journal->sync_ms != CL_JOURNAL_NO_SYNC);
+    close(journal->fd);
+  }
+
+  CL_free(journal->list);
+  _CLJ_free_chunks(journal->chunks);
+  free(journal->record.data);
+  free(journal->pending.data);
+  free(journal->writing.data);
+  free(journal->path);
+  free(journal->snap_path);
+  pthread_mutex_destroy(&journal->lock);
+  pthread_mutex_destroy(&journal->io_lock);
+  pthread_cond_destroy(&journal->wakeup);
+  free(journal);
+
+  return ok;
+}
@@ -0,0 +1,154 @@
+/*
+ * clist_journal.h
+ *
+ * Write-ahead journal for durable CList mutations
+ *
+ * A CListJournal wraps a CList and a log file. Each mutation made
+ * through the journal is applied to the list and appended to the log as
+ * a small checksummed binary record. Reopening the journal loads the
+ * last snapshot and replays the log after it, stopping at the first
+ * record that was torn by a crash. CL_journal_checkpoint writes the
+ * whole list out as a new snapshot and empties the log.
+ *
+ * Records are buffered in memory and made durable according to the
+ * sync interval given to CL_journal_open:
+ *
+ *   0                   each mutation is written and fsync'd before it
+ *                       returns
+ *   > 0                 group commit: a background thread writes and
+ *                       fsyncs everything buffered every sync_ms
+ *                       milliseconds, so a crash loses at most that
+ *                       much
+ *   CL_JOURNAL_NO_SYNC  records are written when the buffer fills and
+ *                       on sync, checkpoint and close, but never
+ *                       fsync'd; durability is left to the OS
+ *
+ * The journal's functions may be called from several threads. The list
+ * returned by CL_journal_list is not locked, though: while other
+ * threads may be changing it, read it with CL_journal_foreach instead.
+ * The log is at path, and the snapshot at path with ".snap" appended.
+ *
+ * The journal owns copies of the elements given to it. Elements it
+ * returns remain valid until the next checkpoint or until the journal
+ * is closed.
+ */
+
+#ifndef _CLIST_JOURNAL_H_
+#define _CLIST_JOURNAL_H_
+
+#include <stdbool.h>
+
+#include "clist.h"
+
+// struct _cl_journal is defined in .c file
+typedef struct _cl_journal *CListJournal;
+
+// Sync interval that never calls fsync
+#define CL_JOURNAL_NO_SYNC  (-1)
+
+
+/*
+ * Open a journal, creating it if it does not exist, and recover the
+ * list from its snapshot and log
+ *
+ * Parameters:
+ *   path      The log file; the snapshot is kept next to it
+ *   sync_ms   How often to make mutations durable; see above
+ *
+ * Returns: The journal, or NULL if the files could not be opened or
+ *   the snapshot is corrupt
+ */
+CListJournal CL_journal_open(const char *path, int sync_ms);
+
+
+/*
+ * Return the journaled list, for reading. The list must only be changed
+ * through the journal. It is the same list for as long as the journal
+ * is open, checkpoints included, but reading it takes no lock, so it
+ * must not be read while another thread calls the journal's functions.
+ *
+ * Parameters:
+ *   journal   The journal
+ *
+ * Returns: The list
+ */
+CList CL_journal_list(CListJournal journal);
+
+
+/*
+ * Call callback on each element of the journaled list in turn, holding
+ * the journal's lock, so that it is safe against other threads changing
+ * the list. The callback must not call the journal's functions.
+ *
+ * Parameters:
+ *   journal   The journal
+ *   callback  The function to call
+ *   cb_data   Passed to each call of callback
+ *
+ * Returns: None
+ */
+void CL_journal_foreach(CListJournal journal, CL_foreach64_callback callback, void *cb_data);
+
+
+/*
+ * Journaled versions of CL_push, CL_append, CL_insert, CL_remove,
+ * CL_pop and CL_reverse. Each behaves as the CList function does, on
+ * the journaled list. Failed operations are not logged.
+ */
+void CL_journal_push(CListJournal journal, CListElementType element);
+void CL_journal_append(CListJournal journal, CListElementType element);
+bool CL_journal_insert(CListJournal journal, CListElementType element, int pos);
+CListElementType CL_journal_remove(CListJournal journal, int pos);
+CListElementType CL_journal_pop(CListJournal journal);
+void CL_journal_reverse(CListJournal journal);
+
+
+/*
+ * Journaled version of CL_join: append copies of the elements of list
+ * to the journaled list, and leave list empty.
+ *
+ * Parameters:
+ *   journal   The journal
+ *   list      The list to take elements from; it is not journaled
+ *
+ * Returns: None
+ */
+void CL_journal_join(CListJournal journal, CList list);
+
+
+/*
+ * Write and fsync everything logged so far, whatever the sync interval
+ *
+ * Parameters:
+ *   journal   The journal
+ *
+ * Returns: true on success, false if this or any earlier write failed
+ */
+bool CL_journal_sync(CListJournal journal);
+
+
+/*
+ * Write the list as a new snapshot and empty the log. A crash at any
+ * point leaves either the old snapshot and log or the new snapshot.
+ *
+ * Parameters:
+ *   journal   The journal
+ *
+ * Returns: true on success, false on an I/O error
+ */
+bool CL_journal_checkpoint(CListJournal journal);
+
+
+/*
+ * Sync and close a journal, freeing its list
+ *
+ * Parameters:
+ *   journal   The journal; if NULL, no action will occur
+ *
+ * Returns: true if everything logged was written successfully
+ */
+bool CL_journal_close(CListJournal journal);
+
+
+
+#endif /* _CLIST_JOURNAL_H_ */
@@ -8,8 +8,16 @@
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 #include "clist.h"
+#include "clist_compact.h"
+#include "clist_external.h"
+#include "clist_journal.h"
 
 
 // Some known testdata, for testing
@@ -167,6 +175,1939 @@ int test_cl_nth()
 }
 
 
+/*
+ * Tests CL_init and the inline node buffer, including moving inline
+ * nodes to another list with CL_join
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_inline_storage()
+{
+  int ret = 0;
+  CListStorage storage;
+  CList small = CL_init(&storage);
+  CList list = CL_new();
+
+  test_assert( CL_length(small) == 0 );
+
+  // Fill the inline nodes and spill a few onto the heap
+  for (int i=0; i < CL_INLINE_NODES + 4; i++)
+    CL_append(small, testdata[i]);
+  test_assert( CL_length(small) == CL_INLINE_NODES + 4 );
+
+  // Free some inline slots in the middle and reuse them
+  test_compare( CL_remove(small, 2), testdata[2] );
+  test_compare( CL_pop(small), testdata[0] );
+  CL_insert(small, testdata[0], 0);
+  CL_insert(small, testdata[2], 2);
+  for (int i=0; i < CL_INLINE_NODES + 4; i++)
+    test_compare( CL_nth(small, i), testdata[i] );
+
+  // Move everything into list, then destroy small
+  CL_push(list, "head");
+  CL_join(list, small);
+  test_assert( CL_length(small) == 0 );
+  CL_free(small);
+
+  test_assert( CL_length(list) == CL_INLINE_NODES + 5 );
+  for (int i=0; i < CL_INLINE_NODES + 4; i++)
+    test_compare( CL_nth(list, i+1), testdata[i] );
+
+  // A caller-storage list can be reinitialized after CL_free
+  small = CL_init(&storage);
+  CL_push(small, testdata[0]);
+  test_compare( CL_nth(small, 0), testdata[0] );
+  CL_free(small);
+
+  ret = 1;
+
+ test_error:
+  CL_free(list);
+  return ret;
+}
+
+
+/*
+ * Tests CL_stats. The counters are only checked in a -DCL_STATS build;
+ * otherwise they must all read as zero.
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_stats()
+{
+  int ret = 0;
+  CList list = CL_new();
+  CList sorted = CL_new();
+  CListStats st;
+
+  for (int i=0; i < num_testdata; i++)
+    CL_append(list, testdata[i]);
+  for (int i=0; i < num_testdata; i++)
+    CL_nth(list, i);
+  CL_remove(list, -1);
+  CL_insert(list, testdata[0], 3);
+
+  CL_stats(list, &st);
+#ifdef CL_STATS
+  test_assert( st.allocs == num_testdata + 1 );
+  test_assert( st.inline_allocs == CL_INLINE_NODES );
+  test_assert( st.frees == 1 );
+  test_assert( st.peak_length == num_testdata );
+  test_assert( st.append_calls == num_testdata );
+  test_assert( st.append_slow == num_testdata - 1 );
+  test_assert( st.append_walked == (num_testdata - 1) * (num_testdata - 2) / 2 );
+  test_assert( st.nth_calls == num_testdata );
+  test_assert( st.nth_walked == num_testdata - 1 );   // from the finger
+  test_assert( st.remove_calls == 1 && st.remove_walked == num_testdata - 2 );
+  test_assert( st.insert_calls == 1 && st.insert_walked == 2 );
+
+  // CL_insert_sorted counts its walk once, as CL_insert does: the
+  // nodes passed to reach the one it links after
+  CL_insert_sorted(sorted, "b");
+  CL_insert_sorted(sorted, "d");
+  CL_insert_sorted(sorted, "f");
+  CL_insert_sorted(sorted, "e");
+  CL_stats(sorted, &st);
+  test_assert( st.insert_calls == 4 && st.insert_walked == 0 + 0 + 1 + 1 );
+
+  CListStats global;
+  CL_stats(NULL, &global);
+  test_assert( global.allocs >= st.allocs );
+  test_assert( global.peak_length >= st.peak_length );
+#else
+  test_assert( st.allocs == 0 && st.nth_walked == 0 && st.peak_length == 0 );
+#endif
+
+  ret = 1;
+
+ test_error:
+  CL_free(list);
+  CL_free(sorted);
+  return ret;
+}
+
+
+// An allocator which tracks how many bytes are outstanding
+static void *tracking_alloc(size_t size, void *ctx)
+{
+  *(long *) ctx += size;
+  return malloc(size);
+}
+
+static void tracking_free(void *ptr, size_t size, void *ctx)
+{
+  *(long *) ctx -= size;
+  free(ptr);
+}
+
+
+/*
+ * Tests CL_new_with_allocator, including joins between lists with
+ * different allocators, and the thread-caching allocator
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_allocator()
+{
+  int ret = 0;
+  long outstanding = 0;
+  CListAllocator tracking = { tracking_alloc, tracking_free, &outstanding };
+  CList list = CL_new_with_allocator(&tracking);
+  CList other = CL_new();
+  CList cached = CL_new_with_allocator(&CL_thread_cache_allocator);
+
+  test_assert( outstanding > 0 );
+
+  for (int i=0; i < num_testdata; i++) {
+    CL_append(list, testdata[i]);
+    CL_append(other, testdata[i]);
+  }
+
+  // Nodes must be re-homed in both directions
+  CL_join(list, other);
+  test_assert( CL_length(list) == 2 * num_testdata );
+  CL_join(other, list);
+  test_assert( CL_length(other) == 2 * num_testdata );
+  for (int i=0; i < 2 * num_testdata; i++)
+    test_compare( CL_nth(other, i), testdata[i % num_testdata] );
+
+  CL_free(list);
+  list = NULL;
+  test_assert( outstanding == 0 );
+
+  // Churn the thread cache; freed nodes are reused
+  for (int round=0; round < 3; round++) {
+    for (int i=0; i < num_testdata; i++)
+      CL_push(cached, testdata[i]);
+    for (int i=num_testdata-1; i >= 0; i--)
+      test_compare( CL_pop(cached), testdata[i] );
+  }
+  CL_join(cached, other);
+  test_assert( CL_length(cached) == 2 * num_testdata );
+
+  ret = 1;
+
+ test_error:
+  CL_free(list);
+  CL_free(other);
+  CL_free(cached);
+  CL_thread_cache_flush();
+  return ret;
+}
+
+
+/*
+ * Tests CL_sort, CL_sort_parallel and CL_copy_parallel. The parallel
+ * versions must produce exactly the same nodes as the serial ones, so
+ * elements are compared by pointer to check stability.
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_sort_copy()
+{
+  int ret = 0;
+  const int big = 50000;
+  char (*keys)[16] = malloc(big * sizeof(*keys));
+  CList list = CL_new();
+  CList serial = NULL, parallel = NULL, copy = NULL;
+
+  // Small list: sorts serially
+  for (int i=0; i < num_testdata; i++)
+    CL_append(list, testdata[i]);
+  CL_sort(list);
+  for (int i=0; i < num_testdata; i++)
+    test_compare( CL_nth(list, i), testdata_sorted[i] );
+  CL_free(list);
+
+  // Big list with many equal keys, so stability matters
+  list = CL_new();
+  srand(26);
+  for (int i=0; i < big; i++) {
+    snprintf(keys[i], sizeof(keys[i]), "k%d", rand() % 1000);
+    CL_push(list, keys[i]);
+  }
+
+  copy = CL_copy_parallel(list, 4);
+  serial = CL_copy(list);
+  parallel = CL_copy(list);
+  test_assert( CL_length(copy) == big );
+  for (int i=big-1; i >= 0; i--)
+    test_assert( CL_pop(copy) == keys[i] );
+
+  CL_sort(serial);
+  CL_sort_parallel(parallel, 7);
+  test_assert( CL_length(parallel) == big );
+  CListElementType prev = "";
+  for (int i=0; i < big; i++) {
+    CListElementType e = CL_pop(serial);
+    test_assert( CL_pop(parallel) == e );
+    test_assert( strcmp(prev, e) <= 0 );
+    prev = e;
+  }
+
+  ret = 1;
+
+ test_error:
+  CL_free(list);
+  CL_free(serial);
+  CL_free(parallel);
+  CL_free(copy);
+  free(keys);
+  return ret;
+}
+
+
+// Shared state for test_cl_read_mostly
+struct rm_state {
+  CList list;
+  int stop;
+  int failures;
+};
+
+// Counts the testdata elements seen, and checks they are in order
+struct rm_scan {
+  int seen;
+  bool ordered;
+};
+
+static void rm_scan_cb(int pos, CListElementType element, void *cb_data)
+{
+  struct rm_scan *scan = cb_data;
+
+  if (scan->seen < num_testdata && element == testdata[scan->seen])
+    scan->seen++;
+  else if (strcmp(element, "temp") != 0)
+    scan->ordered = false;
+}
+
+static void *rm_reader(void *arg)
+{
+  struct rm_state *st = arg;
+
+  while (!__atomic_load_n(&st->stop, __ATOMIC_ACQUIRE)) {
+    CL_read_lock();
+    struct rm_scan scan = { 0, true };
+    CL_foreach(st->list, rm_scan_cb, &scan);
+    CListElementType e = CL_nth(st->list, 0);
+    CL_read_unlock();
+
+    if (scan.seen != num_testdata || !scan.ordered || e == INVALID_RETURN)
+      __atomic_fetch_add(&st->failures, 1, __ATOMIC_RELAXED);
+  }
+
+  return NULL;
+}
+
+
+// A reader that stops on the first element of its walk until told to
+// go on, counting the elements it then reaches
+struct rm_stall {
+  CList list;
+  int entered, resume;
+  int count;
+};
+
+static void rm_stall_cb(int pos, CListElementType element, void *cb_data)
+{
+  struct rm_stall *stall = cb_data;
+
+  if (pos == 0) {
+    __atomic_store_n(&stall->entered, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&stall->resume, __ATOMIC_ACQUIRE))
+      sched_yield();
+  }
+  stall->count++;
+}
+
+static void *rm_stalled_reader(void *arg)
+{
+  struct rm_stall *stall = arg;
+
+  CL_read_lock();
+  CL_foreach(stall->list, rm_stall_cb, stall);
+  CL_read_unlock();
+
+  return NULL;
+}
+
+
+/*
+ * Tests a read-mostly list: readers traverse without locks while a
+ * writer keeps inserting and removing other elements. Under
+ * AddressSanitizer, this also checks that no node is freed while a
+ * reader can still reach it.
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_read_mostly()
+{
+  int ret = 0;
+  const int nreaders = 4;
+  struct rm_state st = { CL_new_read_mostly(), 0, 0 };
+  pthread_t readers[nreaders];
+
+  for (int i=0; i < num_testdata; i++)
+    CL_append(st.list, testdata[i]);
+
+  for (int i=0; i < nreaders; i++)
+    pthread_create(&readers[i], NULL, rm_reader, &st);
+
+  srand(31);
+  for (int i=0; i < 20000; i++) {
+    int pos = rand() % (CL_length(st.list) + 1);
+    CL_insert(st.list, "temp", pos);
+    CL_remove(st.list, pos);
+    if (i % 2 == 0) {
+      CL_push(st.list, "temp");
+      CL_pop(st.list);
+    }
+  }
+
+  __atomic_store_n(&st.stop, 1, __ATOMIC_RELEASE);
+  for (int i=0; i < nreaders; i++)
+    pthread_join(readers[i], NULL);
+  CL_synchronize();
+
+  test_assert( st.failures == 0 );
+  test_assert( CL_length(st.list) == num_testdata );
+  for (int i=0; i < num_testdata; i++)
+    test_compare( CL_nth(st.list, i), testdata[i] );
+
+  // A reader stalled mid-walk holds back every node retired after it
+  // entered, however many there are, and then walks on through them
+  CList stalled = CL_new_read_mostly();
+  struct rm_stall stall = { stalled, 0, 0, 0 };
+  pthread_t reader;
+  for (int i=0; i < 5000; i++)
+    CL_push(stalled, "temp");
+  pthread_create(&reader, NULL, rm_stalled_reader, &stall);
+  while (!__atomic_load_n(&stall.entered, __ATOMIC_ACQUIRE))
+    sched_yield();
+  while (CL_pop(stalled) != INVALID_RETURN)
+    ;
+  __atomic_store_n(&stall.resume, 1, __ATOMIC_RELEASE);
+  pthread_join(reader, NULL);
+  CL_free(stalled);
+  test_assert( stall.count == 5000 );
+
+  ret = 1;
+
+ test_error:
+  CL_free(st.list);
+  CL_synchronize();
+  return ret;
+}
+
+
+// Shared state for test_cl_concurrent
+#define CS_THREADS 4
+#define CS_KEYS 2000
+
+struct cs_state {
+  CListConcurrent list;
+  char (*keys)[16];
+  int thread;
+  int failures;
+};
+
+// Each thread inserts its share of the keys, removing every third one
+// again, and checks that its own keys are visible
+static void *cs_worker(void *arg)
+{
+  struct cs_state *st = arg;
+
+  for (int i = st->thread; i < CS_KEYS; i += CS_THREADS) {
+    CL_concurrent_insert_sorted(st->list, st->keys[i]);
+    if (!CL_concurrent_contains(st->list, st->keys[i]))
+      __atomic_fetch_add(&st->failures, 1, __ATOMIC_RELAXED);
+    if (i % 3 == 0 && !CL_concurrent_remove(st->list, st->keys[i]))
+      __atomic_fetch_add(&st->failures, 1, __ATOMIC_RELAXED);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Tests the concurrent sorted list: several threads insert and remove
+ * at once, and the result must match doing the same with
+ * CL_insert_sorted and CL_remove on a plain list
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_concurrent()
+{
+  int ret = 0;
+  char (*keys)[16] = malloc(CS_KEYS * sizeof(*keys));
+  CListConcurrent list = CL_concurrent_new();
+  CList expected = CL_new();
+  CList actual = NULL;
+  struct cs_state st[CS_THREADS];
+  pthread_t threads[CS_THREADS];
+
+  // Plenty of duplicate keys
+  srand(32);
+  for (int i=0; i < CS_KEYS; i++)
+    snprintf(keys[i], sizeof(keys[i]), "c%d", rand() % 500);
+
+  test_assert( !CL_concurrent_remove(list, "c1") );
+
+  for (int t=0; t < CS_THREADS; t++) {
+    st[t] = (struct cs_state) { list, keys, t, 0 };
+    pthread_create(&threads[t], NULL, cs_worker, &st[t]);
+  }
+  for (int t=0; t < CS_THREADS; t++)
+    pthread_join(threads[t], NULL);
+
+  for (int t=0; t < CS_THREADS; t++)
+    test_assert( st[t].failures == 0 );
+
+  // The sequential equivalent
+  for (int i=0; i < CS_KEYS; i++)
+    CL_insert_sorted(expected, keys[i]);
+  for (int i=0; i < CS_KEYS; i += 3) {
+    int pos = 0;
+    while (strcmp(CL_nth(expected, pos), keys[i]) != 0)
+      pos++;
+    CL_remove(expected, pos);
+  }
+
+  actual = CL_concurrent_to_list(list);
+  test_assert( CL_concurrent_length(list) == CL_length(expected) );
+  test_assert( CL_length(actual) == CL_length(expected) );
+  while (CL_length(expected) > 0)
+    test_compare( CL_pop(actual), CL_pop(expected) );
+
+  ret = 1;
+
+ test_error:
+  CL_concurrent_free(list);
+  CL_free(expected);
+  CL_free(actual);
+  CL_synchronize();
+  free(keys);
+  return ret;
+}
+
+
+// Shared state for test_cl_concurrent_history. Every call is stamped
+// from one logical clock just before it starts and just after it
+// returns, so that a call whose end stamp is below another's start
+// stamp really did finish first.
+#define CH_KEYS 256
+#define CH_REMOVERS 2
+#define CH_READERS 3
+#define CH_LOG 200000
+
+struct ch_event {
+  int key;
+  unsigned long start, end;
+  bool result;
+};
+
+struct ch_state {
+  CListConcurrent list;
+  char (*keys)[8];
+  unsigned long clock;
+  int readers_ready;
+  int removers_left;
+};
+
+struct ch_thread {
+  struct ch_state *st;
+  int thread;
+  struct ch_event *log;
+  int num_events;
+};
+
+static unsigned long ch_stamp(struct ch_state *st)
+{
+  return __atomic_fetch_add(&st->clock, 1, __ATOMIC_SEQ_CST);
+}
+
+// Each remover tries to remove every key once, the two from opposite
+// ends, so that they meet in the middle. They start once the readers
+// are running and yield after each call, so that the calls interleave
+// even on one CPU.
+static void *ch_remover(void *arg)
+{
+  struct ch_thread *t = arg;
+
+  while (__atomic_load_n(&t->st->readers_ready, __ATOMIC_ACQUIRE) < CH_READERS)
+    sched_yield();
+
+  for (int i = 0; i < CH_KEYS; i++) {
+    int key = (t->thread % 2 == 0) ? i : CH_KEYS - 1 - i;
+    struct ch_event *ev = &t->log[t->num_events++];
+    ev->key = key;
+    ev->start = ch_stamp(t->st);
+    ev->result = CL_concurrent_remove(t->st->list, t->st->keys[key]);
+    ev->end = ch_stamp(t->st);
+    sched_yield();
+  }
+  __atomic_fetch_sub(&t->st->removers_left, 1, __ATOMIC_RELEASE);
+
+  return NULL;
+}
+
+// Each reader looks keys up, in an order of its own, until the removers
+// are done
+static void *ch_reader(void *arg)
+{
+  struct ch_thread *t = arg;
+  unsigned seed = t->thread;
+
+  __atomic_fetch_add(&t->st->readers_ready, 1, __ATOMIC_RELEASE);
+  while (__atomic_load_n(&t->st->removers_left, __ATOMIC_ACQUIRE) > 0
+         && t->num_events < CH_LOG) {
+    if (t->num_events % 8 == 7)
+      sched_yield();
+    int key = rand_r(&seed) % CH_KEYS;
+    struct ch_event *ev = &t->log[t->num_events++];
+    ev->key = key;
+    ev->start = ch_stamp(t->st);
+    ev->result = CL_concurrent_contains(t->st->list, t->st->keys[key]);
+    ev->end = ch_stamp(t->st);
+  }
+
+  return NULL;
+}
+
+
+/*
+ * Tests that the concurrent sorted list is linearizable, by racing
+ * lookups against removals of the same keys. Each key starts on the
+ * list once, so its history is: present until some successful remove
+ * takes effect, absent afterwards. The calls on a key are consistent
+ * with that if there is a point L within the successful remove such
+ * that every lookup which found the key started before L, and every
+ * lookup which did not, and every other remove of the key (which must
+ * fail), ended after it.
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_concurrent_history()
+{
+  int ret = 0;
+  char (*keys)[8] = malloc(CH_KEYS * sizeof(*keys));
+  struct ch_state st = { CL_concurrent_new(), keys, 0, 0, CH_REMOVERS };
+  struct ch_thread threads[CH_REMOVERS + CH_READERS];
+  pthread_t ids[CH_REMOVERS + CH_READERS];
+
+  // For each key: the successful remove, the latest start of a lookup
+  // that found it, and the earliest end of any call that did not
+  struct {
+    int removed;
+    unsigned long start, end, latest_found, earliest_missing;
+  } *hist = calloc(CH_KEYS, sizeof(*hist));
+
+  for (int i=0; i < CH_KEYS; i++) {
+    snprintf(keys[i], sizeof(keys[i]), "h%03d", i);
+    CL_concurrent_insert_sorted(st.list, keys[i]);
+  }
+
+  for (int t=0; t < CH_REMOVERS + CH_READERS; t++) {
+    threads[t] = (struct ch_thread) { &st, t, malloc(CH_LOG * sizeof(struct ch_event)), 0 };
+    pthread_create(&ids[t], NULL, t < CH_REMOVERS ? ch_remover : ch_reader, &threads[t]);
+  }
+  for (int t=0; t < CH_REMOVERS + CH_READERS; t++)
+    pthread_join(ids[t], NULL);
+
+  for (int i=0; i < CH_KEYS; i++)
+    hist[i].earliest_missing = ~0UL;
+  for (int t=0; t < CH_REMOVERS + CH_READERS; t++) {
+    for (int e=0; e < threads[t].num_events; e++) {
+      struct ch_event *ev = &threads[t].log[e];
+      if (t < CH_REMOVERS && ev->result) {
+        hist[ev->key].removed++;
+        hist[ev->key].start = ev->start;
+        hist[ev->key].end = ev->end;
+      } else if (t >= CH_REMOVERS && ev->result) {
+        if (ev->start > hist[ev->key].latest_found)
+          hist[ev->key].latest_found = ev->start;
+      } else if (ev->end < hist[ev->key].earliest_missing) {
+        hist[ev->key].earliest_missing = ev->end;
+      }
+    }
+  }
+
+  for (int i=0; i < CH_KEYS; i++) {
+    unsigned long lo = hist[i].start, hi = hist[i].end;
+    if (hist[i].latest_found > lo)
+      lo = hist[i].latest_found;
+    if (hist[i].earliest_missing < hi)
+      hi = hist[i].earliest_missing;
+    test_assert( hist[i].removed == 1 );
+    test_assert( lo < hi );
+  }
+  test_assert( CL_concurrent_length(st.list) == 0 );
+
+  ret = 1;
+
+ test_error:
+  for (int t=0; t < CH_REMOVERS + CH_READERS; t++)
+    free(threads[t].log);
+  CL_concurrent_free(st.list);
+  CL_synchronize();
+  free(hist);
+  free(keys);
+  return ret;
+}
+
+
+/*
+ * Tests CL_from_file, including a file which exactly fills a page and
+ * has no final delimiter
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_from_file()
+{
+  int ret = 0;
+  char path[] = "/tmp/clist_test_XXXXXX";
+  int fd = mkstemp(path);
+  CList list = NULL, other = CL_new();
+
+  test_assert( fd >= 0 );
+  test_assert( CL_from_file("/nonexistent/clist", '\n') == NULL );
+
+  // Empty file
+  list = CL_from_file(path, '\n');
+  test_assert( list != NULL && CL_length(list) == 0 );
+  CL_free(list);
+
+  // Delimiter-terminated, with an empty element in the middle
+  test_assert( write(fd, "One,,Two,", 9) == 9 );
+  list = CL_from_file(path, ',');
+  test_assert( CL_length(list) == 3 );
+  test_compare( CL_nth(list, 0), "One" );
+  test_compare( CL_nth(list, 1), "" );
+  test_compare( CL_nth(list, 2), "Two" );
+  CL_free(list);
+
+  // 4094 'x', a newline, then "y" with no newline: exactly 4096 bytes
+  test_assert( ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0 );
+  char buf[4096];
+  memset(buf, 'x', sizeof(buf));
+  buf[4094] = '\n';
+  buf[4095] = 'y';
+  test_assert( write(fd, buf, sizeof(buf)) == sizeof(buf) );
+  list = CL_from_file(path, '\n');
+  test_assert( CL_length(list) == 2 );
+  test_assert( strlen(CL_nth(list, 0)) == 4094 );
+  test_compare( CL_nth(list, 1), "y" );
+
+  // The file itself is unchanged
+  char check[4096];
+  test_assert( pread(fd, check, sizeof(check), 0) == sizeof(check) );
+  test_assert( memcmp(buf, check, sizeof(buf)) == 0 );
+
+  // Joining hands the mapping over to the other list
+  CL_join(other, list);
+  CL_free(list);
+  list = NULL;
+  test_compare( CL_nth(other, 1), "y" );
+
+  ret = 1;
+
+ test_error:
+  CL_free(list);
+  CL_free(other);
+  if (fd >= 0) {
+    close(fd);
+    unlink(path);
+  }
+  return ret;
+}
+
+
+/*
+ * Tests CL_dedup and CL_unique_sorted
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_dedup()
+{
+  int ret = 0;
+  CList list = CL_new();
+  CList sorted = CL_new();
+  char copies[num_testdata][16];
+
+  test_assert( CL_dedup(list) == 0 );
+  test_assert( CL_unique_sorted(list) == 0 );
+
+  // Each element three times; the later ones are distinct pointers
+  for (int i=0; i < num_testdata; i++) {
+    strcpy(copies[i], testdata[i]);
+    CL_append(list, testdata[i]);
+    CL_insert_sorted(sorted, testdata[i]);
+  }
+  for (int i=0; i < num_testdata; i++) {
+    CL_append(list, copies[i]);
+    CL_insert_sorted(sorted, copies[i]);
+    CL_insert(list, testdata[i], 2 * i);
+    CL_insert_sorted(sorted, testdata[i]);
+  }
+
+  test_assert( CL_dedup(list) == 2 * num_testdata );
+  test_assert( CL_length(list) == num_testdata );
+  for (int i=0; i < num_testdata; i++)
+    test_assert( CL_nth(list, i) == testdata[i] );
+  test_assert( CL_dedup(list) == 0 );
+
+  test_assert( CL_unique_sorted(sorted) == 2 * num_testdata );
+  test_assert( CL_length(sorted) == num_testdata );
+  for (int i=0; i < num_testdata; i++)
+    test_compare( CL_nth(sorted, i), testdata_sorted[i] );
+
+  ret = 1;
+
+ test_error:
+  CL_free(list);
+  CL_free(sorted);
+  return ret;
+}
+
+
+/*
+ * Tests CL_merge_sorted
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_merge_sorted()
+{
+  int ret = 0;
+  CList dst = CL_new();
+  CList src = CL_new();
+  char tie[16];
+
+  // Merging into or from an empty list
+  CL_merge_sorted(dst, src);
+  test_assert( CL_length(dst) == 0 );
+  for (int i=0; i < num_testdata; i += 2)
+    CL_insert_sorted(src, testdata[i]);
+  CL_merge_sorted(dst, src);
+  test_assert( CL_length(dst) == (num_testdata + 1) / 2 );
+  test_assert( CL_length(src) == 0 );
+
+  // Interleave the other half, plus a copy of one existing element
+  for (int i=1; i < num_testdata; i += 2)
+    CL_insert_sorted(src, testdata[i]);
+  strcpy(tie, testdata[0]);
+  CL_insert_sorted(src, tie);
+  CL_merge_sorted(dst, src);
+
+  test_assert( CL_length(src) == 0 );
+  test_assert( CL_length(dst) == num_testdata + 1 );
+  for (int i=0, j=0; i < num_testdata; i++, j++) {
+    if (strcmp(testdata_sorted[i], tie) == 0) {
+      // src's equal element comes first
+      test_assert( CL_nth(dst, j++) == tie );
+    }
+    test_compare( CL_nth(dst, j), testdata_sorted[i] );
+  }
+
+  ret = 1;
+
+ test_error:
+  CL_free(dst);
+  CL_free(src);
+  return ret;
+}
+
+
+// A CL_predicate which matches elements starting with *cb_data
+static bool starts_with(CListElementType element, void *cb_data)
+{
+  return element[0] == *(char *) cb_data;
+}
+
+
+/*
+ * Tests CL_remove_if and CL_partition
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_remove_if()
+{
+  int ret = 0;
+  CList list = CL_new();
+  CList out = CL_new();
+  CListStorage storage;
+  CList small = CL_init(&storage);
+  char t = 'T', f = 'F', s = 'S', x = 'x';
+
+  for (int i=0; i < num_testdata; i++)
+    CL_append(list, testdata[i]);
+
+  // Two, Three, Ten, Twelve, Thirteen, Twenty
+  test_assert( CL_remove_if(list, starts_with, &t) == 6 );
+  test_assert( CL_remove_if(list, starts_with, &x) == 0 );
+  test_assert( CL_length(list) == num_testdata - 6 );
+  for (int i=0; i < CL_length(list); i++)
+    test_assert( CL_nth(list, i)[0] != 'T' );
+
+  // Move Four, Five, Fourteen, Fifteen onto the end of out
+  CL_push(out, "start");
+  test_assert( CL_partition(list, starts_with, &f, out) == 4 );
+  test_assert( CL_length(list) == num_testdata - 10 );
+  test_assert( CL_length(out) == 5 );
+  test_compare( CL_nth(out, 0), "start" );
+  test_compare( CL_nth(out, 1), "Four" );
+  test_compare( CL_nth(out, 2), "Five" );
+  test_compare( CL_nth(out, 3), "Fourteen" );
+  test_compare( CL_nth(out, 4), "Fifteen" );
+
+  // Partition out of a list with inline nodes, then destroy it
+  for (int i=0; i < num_testdata; i++)
+    CL_append(small, testdata[i]);
+  test_assert( CL_partition(small, starts_with, &s, out) == 4 );
+  CL_free(small);
+  test_compare( CL_nth(out, 5), "Six" );
+  test_compare( CL_nth(out, 8), "Seventeen" );
+
+  ret = 1;
+
+ test_error:
+  CL_free(list);
+  CL_free(out);
+  return ret;
+}
+
+
+// Checks CL_compact_foreach visits testdata in order
+static void compact_check_cb(int64_t pos, CListElementType element, void *cb_data)
+{
+  if (pos >= num_testdata || strcmp(element, testdata[pos]) != 0)
+    *(bool *) cb_data = false;
+}
+
+
+/*
+ * Tests the compact list
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_compact()
+{
+  int ret = 0;
+  CListCompact list = CL_compact_new();
+  CList src = CL_new();
+  char *long_string = NULL;
+
+  test_assert( list != NULL );
+  test_assert( CL_compact_length(list) == 0 );
+  test_invalid( CL_compact_pop(list) );
+  test_invalid( CL_compact_nth(list, 0) );
+
+  for (int i=0; i < num_testdata; i++)
+    CL_append(src, testdata[i]);
+  test_assert( CL_compact_append_list(list, src) );
+  test_assert( CL_compact_length(list) == num_testdata );
+
+  // Elements are copies, and negative positions work as for CL_nth
+  for (int i=0; i < num_testdata; i++) {
+    test_compare( CL_compact_nth(list, i), testdata[i] );
+    test_assert( CL_compact_nth(list, i) != testdata[i] );
+    test_compare( CL_compact_nth(list, i - num_testdata), testdata[i] );
+  }
+  test_invalid( CL_compact_nth(list, num_testdata) );
+  test_invalid( CL_compact_nth(list, -num_testdata - 1) );
+
+  bool ok = true;
+  CL_compact_foreach(list, compact_check_cb, &ok);
+  test_assert( ok );
+
+  // Popped nodes are reused; repeated strings share arena space
+  size_t used = CL_compact_memory(list);
+  test_compare( CL_compact_pop(list), testdata[0] );
+  test_assert( CL_compact_push(list, testdata[0]) );
+  test_assert( CL_compact_append(list, "x") );
+  test_assert( CL_compact_append(list, "x") );
+  test_assert( CL_compact_memory(list) == used + 2 * 8 + strlen(testdata[0]) + 1 + 2 );
+  test_compare( CL_compact_nth(list, 0), testdata[0] );
+  test_compare( CL_compact_nth(list, -1), "x" );
+
+  // Drain it completely, then reuse it
+  while (CL_compact_length(list) > 0)
+    CL_compact_pop(list);
+  test_assert( CL_compact_append(list, "y") );
+  test_compare( CL_compact_nth(list, 0), "y" );
+  test_compare( CL_compact_nth(list, -1), "y" );
+
+  // Growing across several pool and arena chunks never moves an
+  // element, and a string longer than a chunk still fits
+  const char *first = CL_compact_nth(list, 0);
+  char buf[32];
+  for (int i=0; i < 200000; i++) {
+    snprintf(buf, sizeof(buf), "element %d", i);
+    test_assert( CL_compact_append(list, buf) );
+  }
+  long_string = malloc(3 << 20);
+  test_assert( long_string != NULL );
+  memset(long_string, 'z', (3 << 20) - 1);
+  long_string[(3 << 20) - 1] = '\0';
+  test_assert( CL_compact_append(list, long_string) );
+  test_assert( CL_compact_append(list, "last") );
+
+  test_assert( CL_compact_nth(list, 0) == first );
+  test_compare( CL_compact_nth(list, 0), "y" );
+  test_compare( CL_compact_nth(list, 1), "element 0" );
+  test_compare( CL_compact_nth(list, 150001), "element 150000" );
+  test_compare( CL_compact_nth(list, -2), long_string );
+  test_compare( CL_compact_nth(list, -1), "last" );
+  test_assert( CL_compact_length(list) == 200003 );
+
+  ret = 1;
+
+ test_error:
+  CL_compact_free(list);
+  CL_free(src);
+  free(long_string);
+  return ret;
+}
+
+
+/*
+ * Tests CL_free_deferred and CL_free_step. AddressSanitizer's leak
+ * checker verifies that everything really is freed.
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_free_deferred()
+{
+  int ret = 0;
+  CListStorage storage;
+  CList list = CL_new();
+
+  CL_free_deferred(NULL);
+
+  for (int round=0; round < 10; round++) {
+    CList big = CL_new();
+    for (int i=0; i < 10000; i++)
+      CL_push(big, testdata[i % num_testdata]);
+    CL_free_deferred(big);
+  }
+  CL_free_deferred(CL_new());
+  CL_free_deferred(CL_init(&storage));
+  CL_free_deferred_wait();
+
+  // A list with the caller's own allocator is freed on this thread,
+  // before CL_free_deferred returns
+  long outstanding = 0;
+  CListAllocator tracking = { tracking_alloc, tracking_free, &outstanding };
+  CList tracked = CL_new_with_allocator(&tracking);
+  for (int i=0; i < 100; i++)
+    CL_push(tracked, testdata[i % num_testdata]);
+  test_assert( outstanding > 0 );
+  CL_free_deferred(tracked);
+  test_assert( outstanding == 0 );
+
+  // 25 nodes in steps of 10
+  for (int i=0; i < 25; i++)
+    CL_push(list, testdata[i % num_testdata]);
+  test_assert( !CL_free_step(list, 10) );
+  test_assert( CL_length(list) == 15 );
+  test_compare( CL_nth(list, 0), testdata[14] );
+  test_assert( !CL_free_step(list, 10) );
+  bool done = CL_free_step(list, 10);
+  list = NULL;
+  test_assert( done );
+
+  ret = 1;
+
+ test_error:
+  CL_free(list);
+  return ret;
+}
+
+
+// Shared by the reader threads of test_cl_finger
+struct finger_readers {
+  CList list;
+  pthread_rwlock_t lock;
+  char (*keys)[8];
+  int length;
+};
+
+// Walks the list with CL_nth under the read lock, forwards and then
+// backwards, a few times
+static void *finger_reader(void *arg)
+{
+  struct finger_readers *fr = arg;
+  long bad = 0;
+
+  for (int round = 0; round < 20; round++) {
+    pthread_rwlock_rdlock(&fr->lock);
+    for (int i = 0; i < fr->length; i++)
+      bad += CL_nth(fr->list, i) != fr->keys[i];
+    for (int i = fr->length - 1; i >= 0; i -= 7)
+      bad += CL_nth(fr->list, i) != fr->keys[i];
+    pthread_rwlock_unlock(&fr->lock);
+  }
+
+  return (void *) bad;
+}
+
+
+/*
+ * Tests that CL_nth, CL_insert and CL_remove stay correct as the list
+ * is changed under the finger they leave behind. In DEBUG builds
+ * CL_length also checks the finger against the list.
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_finger()
+{
+  int ret = 0;
+  CList list = CL_new();
+  CList other = CL_new();
+
+  for (int i=0; i < num_testdata; i++)
+    CL_append(list, testdata[i]);
+
+  // The legacy loop
+  for (int i=0; i < CL_length(list); i++)
+    test_compare( CL_nth(list, i), testdata[i] );
+
+  // Finger at 10; changes ahead of and behind it
+  test_compare( CL_nth(list, 10), testdata[10] );
+  CL_push(list, testdata[0]);
+  test_compare( CL_nth(list, 11), testdata[10] );
+  test_compare( CL_pop(list), testdata[0] );
+  test_compare( CL_nth(list, 10), testdata[10] );
+  test_assert( CL_insert(list, testdata[0], 5) );
+  test_compare( CL_nth(list, 11), testdata[10] );
+  test_compare( CL_remove(list, 5), testdata[0] );
+  test_compare( CL_nth(list, 12), testdata[12] );
+  test_compare( CL_remove(list, 12), testdata[12] );
+  test_compare( CL_nth(list, 12), testdata[13] );
+  test_assert( CL_insert(list, testdata[12], 12) );
+  test_assert( CL_length(list) == num_testdata );
+
+  // Popping the finger's own node
+  test_compare( CL_nth(list, 0), testdata[0] );
+  test_compare( CL_pop(list), testdata[0] );
+  test_compare( CL_nth(list, 0), testdata[1] );
+  CL_push(list, testdata[0]);
+
+  // Operations that rearrange the whole list
+  test_compare( CL_nth(list, 15), testdata[15] );
+  CL_reverse(list);
+  test_compare( CL_nth(list, 15), testdata[num_testdata - 16] );
+  CL_sort(list);
+  test_compare( CL_nth(list, 15), testdata_sorted[15] );
+  CL_append(other, testdata_sorted[0]);
+  CL_merge_sorted(list, other);
+  test_compare( CL_nth(list, 15), testdata_sorted[14] );
+  test_assert( CL_unique_sorted(list) == 1 );
+  test_compare( CL_nth(list, 15), testdata_sorted[15] );
+  test_compare( CL_nth(list, 20), testdata_sorted[20] );
+  CL_join(other, list);
+  test_assert( CL_length(list) == 0 );
+  test_compare( CL_nth(other, 20), testdata_sorted[20] );
+  test_assert( CL_length(other) == num_testdata );
+
+  // CL_nth only reads the list, so threads sharing a read lock do not
+  // disturb each other's walks
+  static char keys[1000][8];
+  struct finger_readers fr = { list, PTHREAD_RWLOCK_INITIALIZER, keys, 1000 };
+  pthread_t threads[8];
+  for (int i=999; i >= 0; i--) {
+    snprintf(keys[i], sizeof(keys[i]), "%d", i);
+    CL_push(list, keys[i]);
+  }
+  for (int t=0; t < 8; t++)
+    pthread_create(&threads[t], NULL, finger_reader, &fr);
+  long bad = 0;
+  for (int t=0; t < 8; t++) {
+    void *n;
+    pthread_join(threads[t], &n);
+    bad += (long) n;
+  }
+  test_assert( bad == 0 );
+
+  ret = 1;
+
+ test_error:
+  CL_free(list);
+  CL_free(other);
+  return ret;
+}
+
+
+// Checks that positions arrive in order, counting them in *cb_data
+static void count64_cb(int64_t pos, CListElementType element, void *cb_data)
+{
+  int64_t *count = cb_data;
+
+  if (pos == *count)
+    (*count)++;
+}
+
+
+/*
+ * Tests the 64-bit position API against the int one
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_64bit()
+{
+  int ret = 0;
+  CList list = CL_new();
+  CList out = NULL;
+  int64_t n = num_testdata;
+
+  for (int i=0; i < num_testdata; i++)
+    test_assert( CL_insert64(list, testdata[i], -1) );
+  test_assert( CL_length64(list) == n );
+  test_assert( !CL_insert64(list, testdata[0], n + 1) );
+  test_assert( !CL_insert64(list, testdata[0], -n - 2) );
+
+  for (int64_t i=0; i < n; i++) {
+    test_compare( CL_nth64(list, i), testdata[i] );
+    test_compare( CL_nth64(list, i - n), testdata[i] );
+  }
+  test_invalid( CL_nth64(list, n) );
+  test_invalid( CL_nth64(list, -n - 1) );
+  test_invalid( CL_nth64(list, INT64_MAX) );
+  test_invalid( CL_nth64(list, INT64_MIN + 1) );
+
+  test_compare( CL_remove64(list, -1), testdata[n - 1] );
+  test_compare( CL_remove64(list, 0), testdata[0] );
+  test_invalid( CL_remove64(list, n - 2) );
+  test_assert( CL_length64(list) == n - 2 );
+
+  int64_t count = 0;
+  CL_foreach64(list, count64_cb, &count);
+  test_assert( count == n - 2 );
+
+  CL_sort(list);
+  test_assert( CL_insert_sorted64(list, "A") == 0 );
+  test_assert( CL_insert_sorted64(list, "zz") == n - 1 );
+  CL_free(list);
+
+  // The counting functions, on a longer list: three copies of each of
+  // 100000 "a..." and "b..." keys
+  static char keys[2][100000][8];
+  const int64_t m = 100000;
+  list = CL_new();
+  out = CL_new();
+  for (int64_t i=m-1; i >= 0; i--) {
+    snprintf(keys[0][i], sizeof(keys[0][i]), "a%06d", (int) i);
+    snprintf(keys[1][i], sizeof(keys[1][i]), "b%06d", (int) i);
+    for (int c=0; c < 3; c++) {
+      CL_push(list, keys[1][i]);
+      CL_push(list, keys[0][i]);
+    }
+  }
+  test_assert( CL_length64(list) == 6 * m );
+  test_compare( CL_nth64(list, 6 * m - 1), keys[1][m - 1] );
+  test_assert( CL_insert64(list, "mid", 3 * m) );
+  test_compare( CL_remove64(list, -3 * m - 1), "mid" );
+  test_assert( CL_unique_sorted64(list) == 0 );
+  test_assert( CL_dedup64(list) == 4 * m );
+  char prefix = 'b';
+  test_assert( CL_partition64(list, starts_with, &prefix, out) == m );
+  prefix = 'a';
+  test_assert( CL_remove_if64(list, starts_with, &prefix) == m );
+  test_assert( CL_length64(list) == 0 );
+  for (int c=0; c < 2; c++) {
+    CList copy = CL_copy(out);
+    CL_join(list, copy);
+    CL_free(copy);
+  }
+  CL_sort(list);
+  test_assert( CL_unique_sorted64(list) == m );
+  count = 0;
+  CL_foreach64(list, count64_cb, &count);
+  test_assert( count == m );
+
+  ret = 1;
+
+ test_error:
+  CL_free(list);
+  CL_free(out);
+  return ret;
+}
+
+
+// Number of elements in the large-scale test, above 2^31 and 3*10^9
+#define LARGE_LENGTH  3200000000LL
+
+// Number of elements in the large-scale CList test, just above 2^31
+#define LARGE_CLIST_LENGTH  ((int64_t) INT32_MAX + 16)
+
+// An allocator handing out consecutive pieces of one large mapping,
+// so that nodes cost 16 bytes each; free does nothing
+struct bump {
+  char *base;
+  size_t used, size;
+};
+
+static void *bump_alloc(size_t size, void *ctx)
+{
+  struct bump *bump = ctx;
+
+  size = (size + 15) & ~(size_t) 15;
+  if (bump->used + size > bump->size)
+    return NULL;
+  void *ptr = bump->base + bump->used;
+  bump->used += size;
+
+  return ptr;
+}
+
+static void bump_free(void *ptr, size_t size, void *ctx)
+{
+}
+
+/*
+ * Builds and traverses a compact list of LARGE_LENGTH elements, then a
+ * CList of LARGE_CLIST_LENGTH elements. This needs about 34 GB of
+ * memory and several minutes, so it only runs if CL_LARGE_TEST is set
+ * in the environment.
+ *
+ * Returns: 1 if all tests pass or the test is skipped, 0 otherwise
+ */
+int test_cl_large()
+{
+  int ret = 0;
+
+  CListCompact list = NULL;
+  CList clist = NULL;
+  struct bump bump = { NULL, 0, 0 };
+  int64_t count;
+
+  if (getenv("CL_LARGE_TEST") == NULL)
+    return 1;
+
+  list = CL_compact_new();
+  test_assert( list != NULL );
+
+  // Consecutive equal strings share arena space, so only the nodes
+  // take up memory
+  test_assert( CL_compact_push(list, "head") );
+  for (int64_t i=1; i < LARGE_LENGTH - 1; i++)
+    test_assert( CL_compact_append(list, "x") );
+  test_assert( CL_compact_append(list, "tail") );
+  test_assert( CL_compact_length(list) == LARGE_LENGTH );
+
+  test_compare( CL_compact_nth(list, 0), "head" );
+  test_compare( CL_compact_nth(list, -LARGE_LENGTH), "head" );
+  test_compare( CL_compact_nth(list, LARGE_LENGTH - 1), "tail" );
+  test_compare( CL_compact_nth(list, -1), "tail" );
+  test_compare( CL_compact_nth(list, (int64_t) INT32_MAX + 1), "x" );
+  test_invalid( CL_compact_nth(list, LARGE_LENGTH) );
+
+  count = 0;
+  CL_compact_foreach(list, count64_cb, &count);
+  test_assert( count == LARGE_LENGTH );
+
+  test_compare( CL_compact_pop(list), "head" );
+  test_assert( CL_compact_length(list) == LARGE_LENGTH - 1 );
+  CL_compact_free(list);
+  list = NULL;
+
+  // The same through the CList 64-bit functions, with every count
+  // past what an int holds
+  bump.size = (LARGE_CLIST_LENGTH + 64) * 16;
+  bump.base = mmap(NULL, bump.size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  test_assert( bump.base != MAP_FAILED );
+  CListAllocator allocator = { bump_alloc, bump_free, &bump };
+  clist = CL_new_with_allocator(&allocator);
+
+  CL_push(clist, "tail");
+  for (int64_t i=2; i < LARGE_CLIST_LENGTH; i++)
+    CL_push(clist, "x");
+  CL_push(clist, "head");
+  test_assert( CL_length64(clist) == LARGE_CLIST_LENGTH );
+  test_compare( CL_nth64(clist, -1), "tail" );
+  test_compare( CL_nth64(clist, -LARGE_CLIST_LENGTH), "head" );
+
+  test_assert( CL_insert64(clist, "far", (int64_t) INT32_MAX + 2) );
+  test_compare( CL_nth64(clist, (int64_t) INT32_MAX + 2), "far" );
+  test_compare( CL_remove64(clist, -3), "x" );
+  test_assert( CL_length64(clist) == LARGE_CLIST_LENGTH );
+
+  count = 0;
+  CL_foreach64(clist, count64_cb, &count);
+  test_assert( count == LARGE_CLIST_LENGTH );
+
+  const char x = 'x';
+  test_assert( CL_remove_if64(clist, starts_with, (void *) &x) == LARGE_CLIST_LENGTH - 3 );
+  test_assert( CL_length64(clist) == 3 );
+  test_compare( CL_nth64(clist, 1), "far" );
+
+  ret = 1;
+
+ test_error:
+  CL_compact_free(list);
+  CL_free(clist);
+  if (bump.base != NULL && bump.base != MAP_FAILED)
+    munmap(bump.base, bump.size);
+  return ret;
+}
+
+
+// Enough records of 41 bytes each (as charged against the budget) to
+// need more runs than one merge can take at the minimum budget
+#define EXTERNAL_RECORDS 400000
+
+/*
+ * Tests CL_sort_external and CL_sort_external_list
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_sort_external()
+{
+  int ret = 0;
+  FILE *in = tmpfile(), *out = tmpfile();
+  CList list = NULL;
+  char buf[64];
+
+  test_assert( in != NULL && out != NULL );
+
+  // Empty input
+  test_assert( CL_sort_external(in, out, ',', "/tmp", 0) );
+  test_assert( ftell(out) == 0 );
+
+  // Small enough to sort in memory; no final delimiter, and an empty
+  // record
+  fputs("pear,apple,,fig", in);
+  rewind(in);
+  test_assert( CL_sort_external(in, out, ',', "/tmp", 0) );
+  rewind(out);
+  test_assert( fgets(buf, sizeof(buf), out) != NULL );
+  test_assert( strcmp(buf, ",apple,fig,pear,") == 0 );
+  fclose(in);
+  fclose(out);
+
+  // Many times the budget
+  in = tmpfile();
+  out = tmpfile();
+  test_assert( in != NULL && out != NULL );
+  unsigned long in_sum = 0, out_sum = 0;
+  srand(37);
+  for (int i=0; i < EXTERNAL_RECORDS; i++) {
+    unsigned int key = rand();
+    in_sum += key;
+    fprintf(in, "%08x\n", key);
+  }
+  rewind(in);
+  test_assert( CL_sort_external(in, out, '\n', "/tmp", CL_EXTERNAL_MIN_BUDGET) );
+
+  rewind(out);
+  char prev[64] = "";
+  int count = 0;
+  while (fgets(buf, sizeof(buf), out) != NULL) {
+    test_assert( strcmp(prev, buf) <= 0 );
+    strcpy(prev, buf);
+    out_sum += strtoul(buf, NULL, 16);
+    count++;
+  }
+  test_assert( count == EXTERNAL_RECORDS );
+  test_assert( out_sum == in_sum );
+
+  // The same, into a list
+  rewind(in);
+  list = CL_sort_external_list(in, '\n', "/tmp", 0);
+  test_assert( list != NULL );
+  test_assert( CL_length(list) == EXTERNAL_RECORDS );
+  const char *prev_element = CL_nth(list, 0);
+  for (int i=1; i < EXTERNAL_RECORDS; i++) {
+    const char *element = CL_nth(list, i);
+    test_assert( strcmp(prev_element, element) <= 0 );
+    prev_element = element;
+  }
+  test_assert( CL_sort_external_list(in, '\n', "/nonexistent/clist", 0) == NULL );
+
+  ret = 1;
+
+ test_error:
+  if (in != NULL)
+    fclose(in);
+  if (out != NULL)
+    fclose(out);
+  CL_free(list);
+  return ret;
+}
+
+
+/*
+ * Tests a compact list shared with a child process
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_compact_shared()
+{
+  int ret = 0;
+  char name[64];
+  snprintf(name, sizeof(name), "/clist_test_%d", (int) getpid());
+  CListCompact list = CL_compact_create_shared(name, 1 << 16, 1 << 16);
+
+  test_assert( list != NULL );
+  test_assert( CL_compact_create_shared(name, 1 << 16, 1 << 16) == NULL );
+  test_assert( CL_compact_attach_shared("/clist_test_nonexistent") == NULL );
+
+  // Limits must be given, and a failed create leaves no segment behind
+  test_assert( CL_compact_create_shared("/clist_test_nolimit", 0, 1 << 16) == NULL );
+  test_assert( CL_compact_create_shared("/clist_test_nolimit", 1 << 16, 0) == NULL );
+  test_assert( CL_compact_attach_shared("/clist_test_nolimit") == NULL );
+
+  for (int i=0; i < num_testdata; i++)
+    test_assert( CL_compact_append(list, testdata[i]) );
+
+  // The child reads the parent's elements in place and appends one
+  pid_t pid = fork();
+  test_assert( pid >= 0 );
+  if (pid == 0) {
+    CListCompact child = CL_compact_attach_shared(name);
+    bool ok = child != NULL && CL_compact_length(child) == num_testdata;
+    for (int i=0; ok && i < num_testdata; i++)
+      ok = strcmp(CL_compact_nth(child, i), testdata[i]) == 0;
+    ok = ok && CL_compact_append(child, "child");
+    CL_compact_free(child);
+    _exit(ok ? 0 : 1);
+  }
+
+  int status;
+  test_assert( waitpid(pid, &status, 0) == pid );
+  test_assert( WIFEXITED(status) && WEXITSTATUS(status) == 0 );
+  test_assert( CL_compact_length(list) == num_testdata + 1 );
+  test_compare( CL_compact_nth(list, -1), "child" );
+
+  // A second attachment in this process sees the same list
+  CListCompact again = CL_compact_attach_shared(name);
+  test_assert( again != NULL );
+  test_compare( CL_compact_pop(again), testdata[0] );
+  CL_compact_free(again);
+  test_compare( CL_compact_nth(list, 0), testdata[1] );
+
+  // A process attaching while the segment is being created either
+  // fails or gets a fully set-up list, whose lock works
+  char racing[64];
+  snprintf(racing, sizeof(racing), "/clist_test_race_%d", (int) getpid());
+  for (int round=0; round < 20; round++) {
+    pid = fork();
+    test_assert( pid >= 0 );
+    if (pid == 0) {
+      CListCompact child = NULL;
+      for (int tries=0; child == NULL && tries < 10000000; tries++)
+        child = CL_compact_attach_shared(racing);
+      bool ok = child != NULL && CL_compact_append(child, "racer");
+      CL_compact_free(child);
+      _exit(ok ? 0 : 1);
+    }
+
+    CListCompact created = CL_compact_create_shared(racing, 1 << 10, 1 << 10);
+    test_assert( created != NULL );
+    test_assert( waitpid(pid, &status, 0) == pid );
+    test_assert( WIFEXITED(status) && WEXITSTATUS(status) == 0 );
+    test_compare( CL_compact_nth(created, 0), "racer" );
+    CL_compact_free(created);
+    CL_compact_unlink_shared(racing);
+  }
+
+  ret = 1;
+
+ test_error:
+  CL_compact_free(list);
+  CL_compact_unlink_shared(name);
+  return ret;
+}
+
+
+// Returns true if list holds exactly the n strings in expected
+static bool list_matches(CList list, const char **expected, int n)
+{
+  if (CL_length(list) != n)
+    return false;
+  for (int i=0; i < n; i++)
+    if (strcmp(CL_nth(list, i), expected[i]) != 0)
+      return false;
+
+  return true;
+}
+
+
+// Returns this process's resident set size in bytes
+static long resident_bytes()
+{
+  long pages = 0, resident = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+
+  if (fp != NULL) {
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+      resident = 0;
+    fclose(fp);
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+
+// Checks that every element CL_journal_foreach visits is a whole
+// "Eltnnnn" string, and counts them
+static void journal_check_cb(int64_t pos, CListElementType element, void *cb_data)
+{
+  if (strncmp(element, "Elt", 3) == 0 && strlen(element) == 7)
+    (*(int64_t *) cb_data)++;
+}
+
+// Reads the journal with CL_journal_foreach until told to stop
+struct journal_reader {
+  CListJournal journal;
+  int stop;
+  bool ok;
+};
+
+static void *journal_reader(void *arg)
+{
+  struct journal_reader *r = arg;
+
+  while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) {
+    int64_t count = 0;
+    CL_journal_foreach(r->journal, journal_check_cb, &count);
+    if (count < 0 || count > 2000)
+      r->ok = false;
+  }
+  return NULL;
+}
+
+
+/*
+ * Tests the write-ahead journal: recovery after close, checkpoints,
+ * torn records and each sync mode
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_journal()
+{
+  int ret = 0;
+  char path[64], snap_path[80];
+  snprintf(path, sizeof(path), "/tmp/clist_journal_%d", (int) getpid());
+  snprintf(snap_path, sizeof(snap_path), "%s.snap", path);
+  unlink(path);
+  unlink(snap_path);
+
+  CListJournal journal = CL_journal_open(path, 0);
+  CList other = CL_new();
+  char buf[8];
+  char *big = NULL;
+
+  test_assert( journal != NULL );
+  test_assert( CL_length(CL_journal_list(journal)) == 0 );
+
+  // The journal keeps its own copies
+  strcpy(buf, "One");
+  CL_journal_append(journal, buf);
+  strcpy(buf, "XXX");
+  CL_journal_push(journal, "Zero");
+  CL_journal_append(journal, "Three");
+  test_assert( CL_journal_insert(journal, "Two", -2) );
+  test_assert( !CL_journal_insert(journal, "Bad", 10) );
+
+  // Rejected inserts keep no copy of their element
+  big = malloc(1 << 20);
+  test_assert( big != NULL );
+  memset(big, 'b', (1 << 20) - 1);
+  big[(1 << 20) - 1] = '\0';
+  long before = resident_bytes();
+  for (int i=0; i < 100; i++)
+    test_assert( !CL_journal_insert(journal, big, 10) );
+  test_assert( resident_bytes() - before < (16 << 20) );
+  CL_append(other, "Four");
+  CL_append(other, "Five");
+  CL_journal_join(journal, other);
+  test_assert( CL_length(other) == 0 );
+  test_compare( CL_journal_remove(journal, 2), "Two" );
+  test_invalid( CL_journal_remove(journal, 10) );
+  const char *step1[] = { "Zero", "One", "Three", "Four", "Five" };
+  test_assert( list_matches(CL_journal_list(journal), step1, 5) );
+  test_assert( CL_journal_close(journal) );
+
+  // Replay
+  journal = CL_journal_open(path, 0);
+  test_assert( journal != NULL );
+  test_assert( list_matches(CL_journal_list(journal), step1, 5) );
+
+  // Checkpoint, then more records on top of the snapshot. The list
+  // itself survives the checkpoint; only its elements are copied.
+  CList held = CL_journal_list(journal);
+  test_assert( CL_journal_checkpoint(journal) );
+  test_assert( CL_journal_list(journal) == held );
+  test_assert( list_matches(held, step1, 5) );
+  CL_journal_reverse(journal);
+  test_compare( CL_journal_pop(journal), "Five" );
+  const char *step2[] = { "Four", "Three", "One", "Zero" };
+  test_assert( list_matches(CL_journal_list(journal), step2, 4) );
+  test_assert( CL_journal_close(journal) );
+
+  // A torn record at the end is dropped
+  int fd = open(path, O_WRONLY | O_APPEND);
+  test_assert( fd >= 0 );
+  test_assert( write(fd, "\x09\x01\x05Sev", 6) == 6 );
+  close(fd);
+  journal = CL_journal_open(path, 0);
+  test_assert( journal != NULL );
+  test_assert( list_matches(CL_journal_list(journal), step2, 4) );
+  CL_journal_push(journal, "Six");
+  test_assert( CL_journal_close(journal) );
+
+  // Group commit, and no fsync at all, recover the same way
+  journal = CL_journal_open(path, 5);
+  test_assert( journal != NULL );
+  test_compare( CL_journal_pop(journal), "Six" );
+  CL_journal_append(journal, "Seven");
+  test_assert( CL_journal_sync(journal) );
+  usleep(20000);
+  CL_journal_append(journal, "Eight");
+  test_assert( CL_journal_close(journal) );
+
+  journal = CL_journal_open(path, CL_JOURNAL_NO_SYNC);
+  test_assert( journal != NULL );
+  const char *step3[] = { "Four", "Three", "One", "Zero", "Seven", "Eight" };
+  test_assert( list_matches(CL_journal_list(journal), step3, 6) );
+  test_compare( CL_journal_remove(journal, 0), "Four" );
+  test_assert( CL_journal_close(journal) );
+
+  journal = CL_journal_open(path, 0);
+  test_assert( journal != NULL );
+  test_assert( list_matches(CL_journal_list(journal), step3 + 1, 5) );
+  test_assert( CL_journal_close(journal) );
+  unlink(path);
+  unlink(snap_path);
+
+  // CL_journal_foreach is safe against appends and checkpoints in
+  // another thread
+  journal = CL_journal_open(path, CL_JOURNAL_NO_SYNC);
+  test_assert( journal != NULL );
+  struct journal_reader reader = { journal, 0, true };
+  pthread_t thread;
+  test_assert( pthread_create(&thread, NULL, journal_reader, &reader) == 0 );
+  for (int i=0; i < 2000; i++) {
+    snprintf(buf, sizeof(buf), "Elt%04d", i);
+    CL_journal_append(journal, buf);
+    if (i % 250 == 249)
+      CL_journal_checkpoint(journal);
+  }
+  __atomic_store_n(&reader.stop, 1, __ATOMIC_RELEASE);
+  pthread_join(thread, NULL);
+  test_assert( reader.ok );
+  int64_t count = 0;
+  CL_journal_foreach(journal, journal_check_cb, &count);
+  test_assert( count == 2000 );
+
+  ret = 1;
+
+ test_error:
+  CL_journal_close(journal);
+  CL_free(other);
+  free(big);
+  unlink(path);
+  unlink(snap_path);
+  return ret;
+}
+
+
+/*
+ * Tests the recency list: touch, evict, remove, lookup and node reuse
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_lru()
+{
+  int ret = 0;
+  CListLRU lru = CL_lru_new(true);
+  CListLRU plain = CL_lru_new(false);
+  CList list = NULL;
+  CListLRUHandle handles[num_testdata];
+  char copy[16];
+
+  test_assert( CL_lru_length(lru) == 0 );
+  test_invalid( CL_lru_evict_tail(lru) );
+  test_assert( CL_lru_find(lru, "Alpha") == NULL );
+
+  // Enough elements to make the hash table grow
+  for (int i=0; i < num_testdata; i++) {
+    handles[i] = CL_lru_push(lru, testdata[i]);
+    test_assert( CL_lru_element(handles[i]) == testdata[i] );
+  }
+  test_assert( CL_lru_length(lru) == num_testdata );
+  for (int i=0; i < num_testdata; i++) {
+    strcpy(copy, testdata[i]);
+    test_assert( CL_lru_find(lru, copy) == handles[i] );
+  }
+
+  // Touch the oldest and a middle element, then evict from the tail
+  CL_lru_touch(lru, handles[0]);
+  CL_lru_touch(lru, handles[2]);
+  CL_lru_touch(lru, handles[2]);
+  list = CL_lru_to_list(lru);
+  test_compare( CL_nth(list, 0), testdata[2] );
+  test_compare( CL_nth(list, 1), testdata[0] );
+  test_compare( CL_nth(list, 2), testdata[num_testdata-1] );
+  test_compare( CL_nth(list, num_testdata-1), testdata[1] );
+  CL_free(list);
+  list = NULL;
+
+  test_compare( CL_lru_evict_tail(lru), testdata[1] );
+  test_compare( CL_lru_evict_tail(lru), testdata[3] );
+  test_assert( CL_lru_find(lru, testdata[1]) == NULL );
+  test_compare( CL_lru_remove(lru, handles[0]), testdata[0] );
+  test_assert( CL_lru_find(lru, testdata[0]) == NULL );
+  test_assert( CL_lru_length(lru) == num_testdata - 3 );
+
+  // Evicted nodes are reused, and duplicates find the newest
+  CListLRUHandle again = CL_lru_push(lru, testdata[2]);
+  test_assert( again == handles[0] );
+  test_assert( CL_lru_find(lru, testdata[2]) == again );
+  CL_lru_remove(lru, again);
+  test_assert( CL_lru_find(lru, testdata[2]) == handles[2] );
+
+  // Without an index, the list works the same way
+  CListLRUHandle a = CL_lru_push(plain, "Alpha");
+  CL_lru_push(plain, "Bravo");
+  CL_lru_touch(plain, a);
+  test_compare( CL_lru_evict_tail(plain), "Bravo" );
+  test_compare( CL_lru_evict_tail(plain), "Alpha" );
+  test_invalid( CL_lru_evict_tail(plain) );
+  test_assert( CL_lru_length(plain) == 0 );
+
+  ret = 1;
+
+ test_error:
+  CL_free(list);
+  CL_lru_free(lru);
+  CL_lru_free(plain);
+  return ret;
+}
+
+
+/*
+ * Tests priority-queue lists against an ordinary sorted list
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_priority_queue()
+{
+  int ret = 0;
+  CList queue = CL_new_priority_queue();
+  CList sorted = CL_new();
+  static char keys[1000][4];
+
+  test_invalid( CL_pop(queue) );
+
+  // Insertions come back out in order, and other calls see them sorted
+  for (int i=0; i < num_testdata; i++)
+    test_assert( CL_insert_sorted(queue, testdata[i]) == CL_NO_POSITION );
+  test_assert( CL_length(queue) == num_testdata );
+  for (int i=0; i < num_testdata; i++)
+    test_compare( CL_nth(queue, i), testdata_sorted[i] );
+
+  // Further insertions merge with the settled list
+  test_assert( CL_insert_sorted64(queue, "Aardvark") == CL_NO_POSITION64 );
+  CL_insert_sorted(queue, "Zulu");
+  test_compare( CL_pop(queue), "Aardvark" );
+  for (int i=0; i < num_testdata; i++)
+    test_compare( CL_pop(queue), testdata_sorted[i] );
+  test_compare( CL_pop(queue), "Zulu" );
+  test_invalid( CL_pop(queue) );
+  test_assert( CL_length(queue) == 0 );
+
+  // Random insertions and pops, with some reads in between
+  srand(46);
+  for (int i=0; i < 1000; i++) {
+    snprintf(keys[i], sizeof(keys[i]), "%c%c", 'a' + rand() % 26, 'a' + rand() % 26);
+    CL_insert_sorted(queue, keys[i]);
+    CL_insert_sorted(sorted, keys[i]);
+    if (rand() % 3 == 0)
+      test_compare( CL_pop(queue), CL_pop(sorted) );
+    if (i % 100 == 99) {
+      int n = CL_length(sorted);
+      test_assert( CL_length(queue) == n );
+      test_compare( CL_nth(queue, n / 2), CL_nth(sorted, n / 2) );
+    }
+  }
+  while (CL_length(sorted) > 0)
+    test_compare( CL_pop(queue), CL_pop(sorted) );
+  test_invalid( CL_pop(queue) );
+
+  ret = 1;
+
+ test_error:
+  CL_free(queue);
+  CL_free(sorted);
+  return ret;
+}
+
+
+// Checks that each element is numbered one more than the last, in
+// the view's order
+struct view_check {
+  CListView view;
+  int64_t next;
+  bool ok;
+};
+
+static void view_check_cb(int64_t pos, CListElementType element, void *cb_data)
+{
+  struct view_check *check = cb_data;
+  if (pos != check->next++ || element != CL_view_nth(check->view, pos))
+    check->ok = false;
+}
+
+
+/*
+ * Tests slices and reversed views
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_cl_view()
+{
+  int ret = 0;
+  CList list = CL_new();
+  CList big = CL_new();
+  CList copy = NULL;
+  CListView view = NULL, reversed = NULL, empty = NULL, whole = NULL;
+  static char keys[1000][8];
+
+  for (int i=num_testdata-1; i >= 0; i--)
+    CL_push(list, testdata[i]);
+
+  test_assert( CL_view_new(list, -1, 3, false) == NULL );
+  test_assert( CL_view_new(list, 4, 3, false) == NULL );
+  test_assert( CL_view_new(list, 0, num_testdata + 1, false) == NULL );
+
+  view = CL_view_new(list, 3, 10, false);
+  reversed = CL_view_new(list, 3, 10, true);
+  empty = CL_view_new(list, num_testdata, num_testdata, true);
+  test_assert( view && reversed && empty );
+  test_assert( CL_view_length(view) == 7 );
+  test_assert( CL_view_length(reversed) == 7 );
+  test_assert( CL_view_length(empty) == 0 );
+  test_invalid( CL_view_nth(empty, 0) );
+
+  for (int i=0; i < 7; i++) {
+    test_compare( CL_view_nth(view, i), testdata[3 + i] );
+    test_compare( CL_view_nth(reversed, i), testdata[9 - i] );
+  }
+  test_compare( CL_view_nth(view, -1), "Nine" );
+  test_compare( CL_view_nth(view, 2), "Five" );
+  test_compare( CL_view_nth(reversed, -1), "Three" );
+  test_invalid( CL_view_nth(view, 7) );
+  test_invalid( CL_view_nth(reversed, -8) );
+
+  copy = CL_view_to_list(reversed);
+  test_assert( CL_length(copy) == 7 );
+  for (int i=0; i < 7; i++)
+    test_compare( CL_nth(copy, i), testdata[9 - i] );
+  CL_free(copy);
+  copy = CL_view_to_list(view);
+  test_assert( CL_length(copy) == 7 );
+  test_compare( CL_nth(copy, 0), "Three" );
+  test_compare( CL_nth(copy, 6), "Nine" );
+
+  // The list itself is untouched
+  test_assert( CL_length(list) == num_testdata );
+  for (int i=0; i < num_testdata; i++)
+    test_compare( CL_nth(list, i), testdata[i] );
+
+  // Reversed foreach over several segments
+  for (int i=999; i >= 0; i--) {
+    snprintf(keys[i], sizeof(keys[i]), "%d", i);
+    CL_push(big, keys[i]);
+  }
+  whole = CL_view_new(big, 0, 1000, true);
+  struct view_check check = { whole, 0, true };
+  CL_view_foreach(whole, view_check_cb, &check);
+  test_assert( check.ok && check.next == 1000 );
+  test_compare( CL_view_nth(whole, 0), "999" );
+  CL_view_free(whole);
+  whole = CL_view_new(big, 10, 990, false);
+  check = (struct view_check) { whole, 0, true };
+  CL_view_foreach(whole, view_check_cb, &check);
+  test_assert( check.ok && check.next == 980 );
+  test_compare( CL_view_nth(whole, 0), "10" );
+  check = (struct view_check) { empty, 0, true };
+  CL_view_foreach(empty, view_check_cb, &check);
+  test_assert( check.ok && check.next == 0 );
+
+  ret = 1;
+
+ test_error:
+  CL_view_free(view);
+  CL_view_free(reversed);
+  CL_view_free(empty);
+  CL_view_free(whole);
+  CL_free(copy);
+  CL_free(list);
+  CL_free(big);
+  return ret;
+}
+
+
   //
   // TODO: Add your code here
   //
@@ -261,6 +2202,28 @@ int main()
   num_tests++; passed += test_cl_push_pop(); 
   num_tests++; passed += test_cl_append();
   num_tests++; passed += test_cl_nth();
+  num_tests++; passed += test_cl_inline_storage();
+  num_tests++; passed += test_cl_stats();
+  num_tests++; passed += test_cl_allocator();
+  num_tests++; passed += test_cl_sort_copy();
+  num_tests++; passed += test_cl_read_mostly();
+  num_tests++; passed += test_cl_concurrent();
+  num_tests++; passed += test_cl_concurrent_history();
+  num_tests++; passed += test_cl_from_file();
+  num_tests++; passed += test_cl_dedup();
+  num_tests++; passed += test_cl_merge_sorted();
+  num_tests++; passed += test_cl_remove_if();
+  num_tests++; passed += test_cl_compact();
+  num_tests++; passed += test_cl_free_deferred();
+  num_tests++; passed += test_cl_finger();
+  num_tests++; passed += test_cl_64bit();
+  num_tests++; passed += test_cl_large();
+  num_tests++; passed += test_cl_sort_external();
+  num_tests++; passed += test_cl_compact_shared();
+  num_tests++; passed += test_cl_journal();
+  num_tests++; passed += test_cl_lru();
+  num_tests++; passed += test_cl_priority_queue();
+  num_tests++; passed += test_cl_view();
 
 
   //